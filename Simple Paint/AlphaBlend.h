@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <emmintrin.h>
+
+// Blends uCount bytes of pColor into pDst: pDst = (pDst * (255 - pAlpha) + pColor * pAlpha) / 255
+void AlphaBlendSpan(uint8_t* pDst, const uint8_t* pAlpha, const uint8_t* pColor, size_t uCount) {
+	size_t i = 0;
+	const __m128i zero = _mm_setzero_si128(), x00ff = _mm_set1_epi16(0xff), x0080 = _mm_set1_epi16(0x80);
+	for (; i + 16 <= uCount; i += 16) {
+		const __m128i dst = _mm_loadu_si128((const __m128i*)(pDst + i)),
+			alpha = _mm_loadu_si128((const __m128i*)(pAlpha + i)),
+			color = _mm_loadu_si128((const __m128i*)(pColor + i));
+		__m128i result[2];
+		for (int j = 0; j < 2; j++) {
+			const __m128i d = j ? _mm_unpackhi_epi8(dst, zero) : _mm_unpacklo_epi8(dst, zero),
+				a = j ? _mm_unpackhi_epi8(alpha, zero) : _mm_unpacklo_epi8(alpha, zero),
+				c = j ? _mm_unpackhi_epi8(color, zero) : _mm_unpacklo_epi8(color, zero);
+			__m128i x = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(d, _mm_sub_epi16(x00ff, a)), _mm_mullo_epi16(c, a)), x0080);
+			result[j] = _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+		}
+		_mm_storeu_si128((__m128i*)(pDst + i), _mm_packus_epi16(result[0], result[1]));
+	}
+	for (; i < uCount; i++) {
+		const uint32_t x = pDst[i] * (255 - pAlpha[i]) + pColor[i] * pAlpha[i] + 0x80;
+		pDst[i] = (uint8_t)((x + (x >> 8)) >> 8);
+	}
+}
\ No newline at end of file
@@ -0,0 +1,185 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+#include "AlphaBlend.h"
+
+#define BRUSH_SUBPIXEL_STEPS 4
+#define BRUSH_DIAMETER_STEPS 4
+#define BRUSH_MIN_DIAMETER 1.0f
+#define BRUSH_MIN_PRESSURE_SCALE 0.25f
+#define BRUSH_MIN_SPACING 0.5f
+#define BRUSH_STAMP_CACHE_SIZE (32 << 20)
+
+// Nothing in this file depends on Windows, so it also builds into the benchmarks
+struct BrushPoint {
+	int32_t x, y;
+};
+
+struct BrushSize {
+	int32_t cx, cy;
+};
+
+// Right and bottom are exclusive; a rect without area is empty
+struct BrushRect {
+	int32_t left, top, right, bottom;
+
+	bool IsEmpty() const { return left >= right || top >= bottom; }
+
+	// Returns false and leaves result empty if the rects do not overlap
+	static bool Intersect(BrushRect& result, const BrushRect& rect1, const BrushRect& rect2) {
+		result = { (std::max)(rect1.left, rect2.left), (std::max)(rect1.top, rect2.top), (std::min)(rect1.right, rect2.right), (std::min)(rect1.bottom, rect2.bottom) };
+		if (!result.IsEmpty())
+			return true;
+		result = { 0 };
+		return false;
+	}
+
+	// Grows result to cover rect as well; empty rects are ignored
+	static void Union(BrushRect& result, const BrushRect& rect) {
+		if (rect.IsEmpty())
+			return;
+		result = result.IsEmpty() ? rect : BrushRect { (std::min)(result.left, rect.left), (std::min)(result.top, rect.top), (std::max)(result.right, rect.right), (std::max)(result.bottom, rect.bottom) };
+	}
+};
+
+struct BrushStamp {
+	BrushPoint Origin; // relative to the pixel containing the dab center
+	BrushSize Size;
+	std::vector<uint8_t> Coverage;
+};
+
+class BrushStampCache {
+private:
+	size_t uSize = 0;
+	std::unordered_map<uint64_t, BrushStamp> stamps;
+
+	static BrushStamp CreateStamp(float fDiameter, uint8_t bHardness, float fCenterX, float fCenterY) {
+		const float fRadius = fDiameter / 2, fExtent = fRadius + 0.5f, fFalloff = 1 + (255 - bHardness) * fRadius / 255;
+		BrushStamp stamp;
+		stamp.Origin = { (int32_t)floorf(fCenterX - fExtent), (int32_t)floorf(fCenterY - fExtent) };
+		stamp.Size = { (int32_t)ceilf(fCenterX + fExtent) - stamp.Origin.x, (int32_t)ceilf(fCenterY + fExtent) - stamp.Origin.y };
+		stamp.Coverage.resize((size_t)stamp.Size.cx * stamp.Size.cy);
+		uint8_t* pCoverage = stamp.Coverage.data();
+		for (int32_t y = 0; y < stamp.Size.cy; y++) {
+			const float fDY = stamp.Origin.y + y + 0.5f - fCenterY;
+			for (int32_t x = 0; x < stamp.Size.cx; x++) {
+				const float fDX = stamp.Origin.x + x + 0.5f - fCenterX,
+					fCoverage = (fExtent - sqrtf(fDX * fDX + fDY * fDY)) / fFalloff;
+				*pCoverage++ = fCoverage <= 0 ? 0 : fCoverage >= 1 ? 0xff : (uint8_t)(fCoverage * 0xff + 0.5f);
+			}
+		}
+		return stamp;
+	}
+
+public:
+	const BrushStamp& Get(float fDiameter, uint8_t bHardness, uint32_t uSubpixelX, uint32_t uSubpixelY) {
+		const uint32_t uDiameter = (uint32_t)(fDiameter * BRUSH_DIAMETER_STEPS + 0.5f);
+		const uint64_t ullKey = (uint64_t)uDiameter << 24 | (uint64_t)bHardness << 16 | uSubpixelY << 8 | uSubpixelX;
+		auto it = stamps.find(ullKey);
+		if (it == stamps.end()) {
+			if (uSize > BRUSH_STAMP_CACHE_SIZE) {
+				stamps.clear();
+				uSize = 0;
+			}
+			it = stamps.emplace(ullKey, CreateStamp((float)uDiameter / BRUSH_DIAMETER_STEPS, bHardness, (float)uSubpixelX / BRUSH_SUBPIXEL_STEPS, (float)uSubpixelY / BRUSH_SUBPIXEL_STEPS)).first;
+			uSize += it->second.Coverage.size();
+		}
+		return it->second;
+	}
+};
+
+// Stamps cached coverage masks along strokes into top-down 24-bit rows
+class BrushEngine {
+private:
+	static const uint32_t dwPixelSize = 3;
+	uint8_t* pBits;
+	uint32_t dwScanLineSize;
+	BrushSize bitmapSize;
+	uint8_t bHardness;
+	float fDiameter, fSpacing, fLastX, fLastY, fLastPressure, fDistance;
+	std::vector<uint8_t> colorSpan, alphaSpan;
+	BrushStampCache stampCache;
+
+	float GetDiameter(float fPressure) const { return (std::max)(fDiameter * (BRUSH_MIN_PRESSURE_SCALE + (1 - BRUSH_MIN_PRESSURE_SCALE) * fPressure), BRUSH_MIN_DIAMETER); }
+
+	float GetSpacing(float fPressure) const { return (std::max)(GetDiameter(fPressure) * fSpacing, BRUSH_MIN_SPACING); }
+
+	void Dab(float fX, float fY, float fPressure, BrushRect& dirtyRect) {
+		int32_t lX = (int32_t)floorf(fX), lY = (int32_t)floorf(fY);
+		uint32_t uSubpixelX = (uint32_t)((fX - lX) * BRUSH_SUBPIXEL_STEPS + 0.5f), uSubpixelY = (uint32_t)((fY - lY) * BRUSH_SUBPIXEL_STEPS + 0.5f);
+		if (uSubpixelX == BRUSH_SUBPIXEL_STEPS) {
+			uSubpixelX = 0;
+			lX++;
+		}
+		if (uSubpixelY == BRUSH_SUBPIXEL_STEPS) {
+			uSubpixelY = 0;
+			lY++;
+		}
+		const BrushStamp& stamp = stampCache.Get(GetDiameter(fPressure), bHardness, uSubpixelX, uSubpixelY);
+		const BrushRect stampRect = { lX + stamp.Origin.x, lY + stamp.Origin.y, lX + stamp.Origin.x + stamp.Size.cx, lY + stamp.Origin.y + stamp.Size.cy },
+			bitmapRect = { 0, 0, bitmapSize.cx, bitmapSize.cy };
+		BrushRect rect;
+		if (!BrushRect::Intersect(rect, stampRect, bitmapRect))
+			return;
+		// A point is covered by about diameter / spacing dabs, so each dab gets the opacity that adds up to the pressure over that many
+		const float fOpacity = 1 - powf(1 - (std::min)((std::max)(fPressure, 0.0f), 1.0f), GetSpacing(fPressure) / GetDiameter(fPressure));
+		const uint32_t uOpacity = fPressure > 0 ? (std::max)((uint32_t)(fOpacity * 0xff + 0.5f), 1u) : 0;
+		const size_t uCount = (size_t)(rect.right - rect.left) * dwPixelSize;
+		for (int32_t y = rect.top; y < rect.bottom; y++) {
+			const uint8_t* pCoverage = &stamp.Coverage[(size_t)(y - stampRect.top) * stamp.Size.cx + (rect.left - stampRect.left)];
+			uint8_t* pAlpha = alphaSpan.data();
+			for (int32_t x = rect.left; x < rect.right; x++, pAlpha += dwPixelSize)
+				pAlpha[0] = pAlpha[1] = pAlpha[2] = (uint8_t)((*pCoverage++ * uOpacity + 127) / 0xff);
+			AlphaBlendSpan(pBits + (size_t)y * dwScanLineSize + rect.left * dwPixelSize, alphaSpan.data(), colorSpan.data(), uCount);
+		}
+		BrushRect::Union(dirtyRect, rect);
+	}
+
+public:
+	// dwColor is laid out like a COLORREF: 0x00BBGGRR
+	BrushRect BeginStroke(uint8_t* pBits, uint32_t dwScanLineSize, BrushSize bitmapSize, uint32_t dwColor, float fDiameter, uint8_t bHardness, float fSpacing, float fX, float fY, float fPressure) {
+		this->pBits = pBits;
+		this->dwScanLineSize = dwScanLineSize;
+		this->bitmapSize = bitmapSize;
+		this->fDiameter = fDiameter;
+		this->bHardness = bHardness;
+		this->fSpacing = fSpacing;
+		const size_t uSpanSize = (size_t)bitmapSize.cx * dwPixelSize;
+		alphaSpan.resize(uSpanSize);
+		colorSpan.resize(uSpanSize);
+		for (size_t i = 0; i < uSpanSize; i += dwPixelSize) {
+			colorSpan[i] = (uint8_t)(dwColor >> 16);
+			colorSpan[i + 1] = (uint8_t)(dwColor >> 8);
+			colorSpan[i + 2] = (uint8_t)dwColor;
+		}
+		BrushRect dirtyRect = { 0 };
+		Dab(fX, fY, fPressure, dirtyRect);
+		fLastX = fX;
+		fLastY = fY;
+		fLastPressure = fPressure;
+		fDistance = GetSpacing(fPressure);
+		return dirtyRect;
+	}
+
+	BrushRect StrokeTo(float fX, float fY, float fPressure) {
+		BrushRect dirtyRect = { 0 };
+		const float fDX = fX - fLastX, fDY = fY - fLastY, fLength = sqrtf(fDX * fDX + fDY * fDY);
+		float fTraveled = 0;
+		while (fTraveled + fDistance <= fLength) {
+			fTraveled += fDistance;
+			const float t = fTraveled / fLength, fDabPressure = fLastPressure + (fPressure - fLastPressure) * t;
+			Dab(fLastX + fDX * t, fLastY + fDY * t, fDabPressure, dirtyRect);
+			fDistance = GetSpacing(fDabPressure);
+		}
+		fDistance -= fLength - fTraveled;
+		fLastX = fX;
+		fLastY = fY;
+		fLastPressure = fPressure;
+		return dirtyRect;
+	}
+};
\ No newline at end of file
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <Windows.h>
+#include <CommCtrl.h>
+#include <string>
+#include "resource.h"
+
+enum class DiagnosticReadouts { Startup, FrameTime, Latency, Cache, Glyphs, TimeLapse, SharedCanvas, Count };
+
+// Keeps the latest text of every readout, shows the one set last in a status bar part and all of them in a modeless
+// dialog, so every readout stays visible however narrow the window is
+class Diagnostics {
+private:
+	HWND hWnd_StatusBar = NULL, hDlg = NULL;
+	int iStatusBarPart;
+	std::wstring readouts[(size_t)DiagnosticReadouts::Count];
+
+	std::wstring GetText() const {
+		std::wstring text;
+		for (const std::wstring& readout : readouts)
+			if (!readout.empty())
+				text += readout + L"\r\n";
+		return text.empty() ? L"No readouts yet" : text;
+	}
+
+	static INT_PTR CALLBACK DlgProc(HWND hDlg, UINT uMsg, WPARAM wParam, LPARAM lParam) {
+		switch (uMsg) {
+		case WM_INITDIALOG: {
+			SetWindowLongPtrW(hDlg, DWLP_USER, lParam);
+			SetDlgItemTextW(hDlg, IDC_DIAGNOSTICS, ((const Diagnostics*)lParam)->GetText().c_str());
+		}	return TRUE;
+		case WM_COMMAND:
+			switch (LOWORD(wParam)) {
+			case IDOK: case IDCANCEL: DestroyWindow(hDlg); return TRUE;
+			}
+			break;
+		case WM_DESTROY: ((Diagnostics*)GetWindowLongPtrW(hDlg, DWLP_USER))->hDlg = NULL; break;
+		}
+		return FALSE;
+	}
+
+public:
+	void Create(HWND hWnd_StatusBar, int iStatusBarPart) {
+		this->hWnd_StatusBar = hWnd_StatusBar;
+		this->iStatusBarPart = iStatusBarPart;
+	}
+
+	// Empty text clears the readout; unchanged text leaves the status bar showing whichever readout changed last
+	void Set(DiagnosticReadouts readout, const std::wstring& text) {
+		if (readouts[(size_t)readout] == text)
+			return;
+		readouts[(size_t)readout] = text;
+		SendMessageW(hWnd_StatusBar, SB_SETTEXT, iStatusBarPart, (LPARAM)(text.empty() ? NULL : text.c_str()));
+		if (hDlg != NULL)
+			SetDlgItemTextW(hDlg, IDC_DIAGNOSTICS, GetText().c_str());
+	}
+
+	void Show(HWND hWnd_Owner) {
+		if (hDlg == NULL)
+			hDlg = CreateDialogParamW(GetModuleHandle(NULL), MAKEINTRESOURCEW(IDD_DIALOG_DIAGNOSTICS), hWnd_Owner, DlgProc, (LPARAM)this);
+		if (hDlg != NULL) {
+			ShowWindow(hDlg, SW_SHOW);
+			SetActiveWindow(hDlg);
+		}
+	}
+
+	// For the message loop, so the dialog handles Tab, Enter and Esc
+	BOOL TranslateDialogMessage(LPMSG lpMsg) const { return hDlg != NULL && IsDialogMessageW(hDlg, lpMsg); }
+};
\ No newline at end of file
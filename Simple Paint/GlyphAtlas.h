@@ -0,0 +1,158 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "AlphaBlend.h"
+
+#define TEXT_ATLAS_WIDTH 512
+#define TEXT_ATLAS_CACHE_SIZE (16 << 20)
+
+// Nothing in this file depends on Windows or on how glyphs are rasterized, so it also builds into the benchmarks
+struct GlyphPoint {
+	int32_t x, y;
+};
+
+struct GlyphSize {
+	int32_t cx, cy;
+};
+
+// Right and bottom are exclusive; a rect without area is empty
+struct GlyphRect {
+	int32_t left, top, right, bottom;
+
+	bool IsEmpty() const { return left >= right || top >= bottom; }
+
+	// Returns false and leaves result empty if the rects do not overlap
+	static bool Intersect(GlyphRect& result, const GlyphRect& rect1, const GlyphRect& rect2) {
+		result = { (std::max)(rect1.left, rect2.left), (std::max)(rect1.top, rect2.top), (std::min)(rect1.right, rect2.right), (std::min)(rect1.bottom, rect2.bottom) };
+		if (!result.IsEmpty())
+			return true;
+		result = { 0 };
+		return false;
+	}
+
+	// Grows result to cover rect as well; empty rects are ignored
+	static void Union(GlyphRect& result, const GlyphRect& rect) {
+		if (rect.IsEmpty())
+			return;
+		result = result.IsEmpty() ? rect : GlyphRect { (std::min)(result.left, rect.left), (std::min)(result.top, rect.top), (std::max)(result.right, rect.right), (std::max)(result.bottom, rect.bottom) };
+	}
+};
+
+struct Glyph {
+	GlyphPoint Origin; // top left of the coverage mask relative to the pen position on the baseline
+	GlyphSize Size;
+	int32_t lAdvance;
+	GlyphPoint AtlasPosition;
+};
+
+struct PlacedGlyph {
+	wchar_t wc;
+	GlyphPoint Pen; // on the baseline
+	GlyphRect Bounds;
+	const Glyph* pGlyph; // NULL for line breaks
+};
+
+// Coverage masks of rasterized glyphs, one shelf-packed 8-bit page per font face, size, weight and style
+class GlyphAtlas {
+public:
+	class Page {
+	private:
+		friend class GlyphAtlas;
+
+		int32_t lWidth, lShelfX = 0, lShelfY = 0, lShelfHeight = 0;
+		std::vector<uint8_t> coverage; // rows of lWidth bytes
+		std::unordered_map<wchar_t, Glyph> glyphs; // node based, so glyph pointers stay valid until the atlas is trimmed
+
+	public:
+		int32_t lAscent = 0, lLineHeight = 0;
+		bool bMetrics = false; // lAscent and lLineHeight are set
+
+		Page(int32_t lWidth) : lWidth(lWidth) {}
+
+		const Glyph* Find(wchar_t wc) const {
+			const auto it = glyphs.find(wc);
+			return it == glyphs.end() ? NULL : &it->second;
+		}
+
+		// Packs glyph.Size.cx by glyph.Size.cy bytes of pCoverage into the page; glyphs wider than the page are cropped
+		const Glyph& Add(wchar_t wc, Glyph glyph, const uint8_t* pCoverage) {
+			const int32_t lSourceWidth = glyph.Size.cx;
+			glyph.Size.cx = (std::min)(glyph.Size.cx, lWidth);
+			if (lShelfX + glyph.Size.cx > lWidth) {
+				lShelfY += lShelfHeight;
+				lShelfX = lShelfHeight = 0;
+			}
+			glyph.AtlasPosition = { lShelfX, lShelfY };
+			lShelfX += glyph.Size.cx;
+			lShelfHeight = (std::max)(lShelfHeight, glyph.Size.cy);
+			coverage.resize((size_t)(lShelfY + lShelfHeight) * lWidth);
+			for (int32_t y = 0; y < glyph.Size.cy; y++)
+				memcpy(&coverage[(size_t)(glyph.AtlasPosition.y + y) * lWidth + glyph.AtlasPosition.x], pCoverage + (size_t)y * lSourceWidth, glyph.Size.cx);
+			return glyphs[wc] = glyph;
+		}
+
+		const uint8_t* GetCoverage(const Glyph& glyph, int32_t x, int32_t y) const { return &coverage[(size_t)(glyph.AtlasPosition.y + y) * lWidth + glyph.AtlasPosition.x + x]; }
+
+		size_t GetSize() const { return coverage.size(); }
+	};
+
+private:
+	std::map<std::pair<std::wstring, uint64_t>, Page> pages;
+
+public:
+	Page& GetPage(const wchar_t* lpcwFace, int32_t lHeight, int32_t lWeight, bool bItalic) {
+		const uint64_t ullKey = (uint64_t)lHeight << 32 | (uint64_t)lWeight << 1 | (bItalic ? 1 : 0);
+		return pages.emplace(std::make_pair(std::wstring(lpcwFace), ullKey), Page((std::max)((int32_t)TEXT_ATLAS_WIDTH, lHeight * 4))).first->second;
+	}
+
+	// Drops every page once they hold more than TEXT_ATLAS_CACHE_SIZE bytes; invalidates pages and glyph pointers
+	void Trim() {
+		size_t uSize = 0;
+		for (const auto& page : pages)
+			uSize += page.second.GetSize();
+		if (uSize > TEXT_ATLAS_CACHE_SIZE)
+			pages.clear();
+	}
+};
+
+// Places the glyphs of text from origin, the top left of the first line; every glyph must be in page already
+std::vector<PlacedGlyph> LayoutText(const GlyphAtlas::Page& page, const std::wstring& text, GlyphPoint origin) {
+	std::vector<PlacedGlyph> placedGlyphs;
+	placedGlyphs.reserve(text.size());
+	GlyphPoint pen = { origin.x, origin.y + page.lAscent };
+	for (const wchar_t wc : text) {
+		PlacedGlyph placedGlyph = { wc, pen, { 0 }, wc == L'\n' ? NULL : page.Find(wc) };
+		if (placedGlyph.pGlyph) {
+			const Glyph& glyph = *placedGlyph.pGlyph;
+			placedGlyph.Bounds = { pen.x + glyph.Origin.x, pen.y + glyph.Origin.y, pen.x + glyph.Origin.x + glyph.Size.cx, pen.y + glyph.Origin.y + glyph.Size.cy };
+			pen.x += glyph.lAdvance;
+		}
+		else if (wc == L'\n')
+			pen = { origin.x, pen.y + page.lLineHeight };
+		placedGlyphs.push_back(placedGlyph);
+	}
+	return placedGlyphs;
+}
+
+// Blends the part of a placed glyph inside clipRect into top-down 24-bit rows; pColorSpan and pAlphaSpan hold a row of the clip width
+void BlendGlyph(uint8_t* pBits, uint32_t dwScanLineSize, const GlyphRect& clipRect, const GlyphAtlas::Page& page, const PlacedGlyph& placedGlyph, const uint8_t* pColorSpan, uint8_t* pAlphaSpan) {
+	GlyphRect rect;
+	if (!placedGlyph.pGlyph || !GlyphRect::Intersect(rect, placedGlyph.Bounds, clipRect))
+		return;
+	const uint32_t dwPixelSize = 3;
+	const size_t uCount = (size_t)(rect.right - rect.left) * dwPixelSize;
+	for (int32_t y = rect.top; y < rect.bottom; y++) {
+		const uint8_t* pCoverage = page.GetCoverage(*placedGlyph.pGlyph, rect.left - placedGlyph.Bounds.left, y - placedGlyph.Bounds.top);
+		uint8_t* pAlpha = pAlphaSpan;
+		for (int32_t x = rect.left; x < rect.right; x++, pAlpha += dwPixelSize)
+			pAlpha[0] = pAlpha[1] = pAlpha[2] = *pCoverage++;
+		AlphaBlendSpan(pBits + (size_t)y * dwScanLineSize + rect.left * dwPixelSize, pAlphaSpan, pColorSpan, uCount);
+	}
+}
\ No newline at end of file
@@ -0,0 +1,236 @@
+#pragma once
+
+#include <Windows.h>
+#include <map>
+#include <vector>
+#include "LazyBitmap.h"
+#include "SpillCache.h"
+
+#define HISTORY_KEYFRAME_INTERVAL 16
+#define HISTORY_CHUNK_SIZE (1 << 16) // PIXELs per payload of an entry
+
+struct PIXEL {
+	DWORD dwDIBSectionIndex;
+	RGBTRIPLE Before, After;
+};
+
+// Linear undo/redo history over a lazily committed top-down 24-bit DIB section: state i is reached by applying entries [0, i) to a blank canvas.
+// Every HISTORY_KEYFRAME_INTERVAL states a full snapshot is kept, so jumping to any state restores at most one snapshot
+// and then applies at most HISTORY_KEYFRAME_INTERVAL - 1 deltas, unless applying deltas from the current state directly is cheaper.
+// Pixel payloads live in a SpillCache, so old entries and snapshots move to disk once the history outgrows its memory budget.
+// Entries are stored in chunks of HISTORY_CHUNK_SIZE pixels, which go to the cache as they fill up, so an entry that
+// changes the whole canvas never has to be held in RAM at once.
+class History {
+private:
+	static const DWORD dwPixelSize = 3;
+
+	struct Entry {
+		LPCWSTR lpcwName;
+		SIZE SizeBefore, SizeAfter;
+		size_t uPixelCount;
+		std::vector<ULONGLONG> Chunks; // payload ids of HISTORY_CHUNK_SIZE PIXELs each, except for the last one
+	};
+
+	struct Keyframe {
+		SIZE Size;
+		std::vector<ULONGLONG> Bands; // payload ids of rows of Size.cx pixels without padding per band; 0 for white bands
+	};
+
+	LazyBitmap* pBitmap;
+	SIZE currentSize;
+	size_t uPosition;
+	std::vector<Entry> entries;
+	std::map<size_t, Keyframe> keyframes;
+	SpillCache cache;
+	Entry nextEntry; // pixels added since the last Push
+	std::vector<BYTE> chunk; // PIXELs of nextEntry not yet in the cache
+
+	void AddChunk() {
+		if (chunk.empty())
+			return;
+		nextEntry.Chunks.push_back(cache.Add(std::vector<BYTE>(chunk.begin(), chunk.end())));
+		chunk.clear();
+	}
+
+	void RemoveChunks(const Entry& entry) {
+		for (const ULONGLONG ullChunk : entry.Chunks)
+			cache.Remove(ullChunk);
+	}
+
+	BOOL Apply(const Entry& entry, BOOL bForward) {
+		const PBYTE pBits = pBitmap->GetBits();
+		const DWORD dwScanLineSize = pBitmap->GetScanLineSize();
+		Resize(bForward ? entry.SizeAfter : entry.SizeBefore);
+		for (const ULONGLONG ullChunk : entry.Chunks) {
+			const std::vector<BYTE>* pChunk = cache.Get(ullChunk);
+			if (!pChunk)
+				return FALSE;
+			const PIXEL* pPixels = (const PIXEL*)pChunk->data();
+			for (size_t i = 0; i < pChunk->size() / sizeof(PIXEL); i++) {
+				const PIXEL& pixel = pPixels[i];
+				const LONG y = pixel.dwDIBSectionIndex / dwScanLineSize;
+				pBitmap->Write(y, y + 1);
+				(RGBTRIPLE&)pBits[pixel.dwDIBSectionIndex] = bForward ? pixel.After : pixel.Before;
+			}
+		}
+		return TRUE;
+	}
+
+	void CaptureKeyframe() {
+		const PBYTE pBits = pBitmap->GetBits();
+		const DWORD dwScanLineSize = pBitmap->GetScanLineSize(), dwRowSize = currentSize.cx * dwPixelSize;
+		Keyframe& keyframe = keyframes[uPosition];
+		keyframe.Size = currentSize;
+		keyframe.Bands.assign(pBitmap->GetBand(currentSize.cy - 1) + 1, 0);
+		for (size_t i = 0; i < keyframe.Bands.size(); i++) {
+			const LONG lTop = (LONG)i * LAZY_BITMAP_BAND_HEIGHT, lBottom = min(lTop + LAZY_BITMAP_BAND_HEIGHT, currentSize.cy);
+			if (pBitmap->IsMaterialized(lTop)) {
+				std::vector<BYTE> band;
+				band.reserve((size_t)(lBottom - lTop) * dwRowSize);
+				for (LONG y = lTop; y < lBottom; y++)
+					band.insert(band.end(), pBits + y * dwScanLineSize, pBits + y * dwScanLineSize + dwRowSize);
+				keyframe.Bands[i] = cache.Add(std::move(band));
+			}
+		}
+	}
+
+	void RemoveKeyframes(size_t uFirst) {
+		for (auto it = keyframes.lower_bound(uFirst); it != keyframes.end(); it = keyframes.erase(it))
+			for (const ULONGLONG ullBand : it->second.Bands)
+				if (ullBand)
+					cache.Remove(ullBand);
+	}
+
+	// Returns FALSE with the last error set if a band cannot be read back, leaving the bands before it restored
+	BOOL RestoreKeyframe(size_t uIndex) {
+		const PBYTE pBits = pBitmap->GetBits();
+		const Keyframe& keyframe = keyframes.at(uIndex);
+		const DWORD dwScanLineSize = pBitmap->GetScanLineSize(), dwRowSize = keyframe.Size.cx * dwPixelSize;
+		for (size_t i = 0; i * LAZY_BITMAP_BAND_HEIGHT < (size_t)keyframe.Size.cy; i++)
+			if (i >= keyframe.Bands.size() || !keyframe.Bands[i])
+				pBitmap->Discard(i);
+			else {
+				const LONG lTop = (LONG)i * LAZY_BITMAP_BAND_HEIGHT, lBottom = min(lTop + LAZY_BITMAP_BAND_HEIGHT, keyframe.Size.cy);
+				const std::vector<BYTE>* pBand = cache.Get(keyframe.Bands[i]);
+				if (!pBand)
+					return FALSE;
+				pBitmap->Write(lTop, lBottom);
+				for (LONG y = lTop; y < lBottom; y++)
+					CopyMemory(pBits + y * dwScanLineSize, &(*pBand)[(size_t)(y - lTop) * dwRowSize], dwRowSize);
+			}
+		currentSize = keyframe.Size;
+		uPosition = uIndex;
+		return TRUE;
+	}
+
+	// Estimated bytes written when walking the deltas between two states
+	size_t GetDeltaCost(size_t uFrom, size_t uTo) const {
+		size_t uCost = 0;
+		for (size_t i = min(uFrom, uTo); i < max(uFrom, uTo); i++)
+			uCost += entries[i].uPixelCount * sizeof(RGBTRIPLE);
+		return uCost;
+	}
+
+	size_t GetKeyframeCost(size_t uIndex) const {
+		size_t uCost = 0;
+		for (const ULONGLONG ullBand : keyframes.at(uIndex).Bands)
+			if (ullBand)
+				uCost += cache.GetSize(ullBand);
+		return uCost;
+	}
+
+public:
+	void Reset(LazyBitmap* pBitmap, SIZE size, SIZE_T uMemoryBudget) {
+		this->pBitmap = pBitmap;
+		cache.SetBudget(uMemoryBudget);
+		Clear(size);
+	}
+
+	// Turns the bitmap white and forgets all entries
+	void Clear(SIZE size) {
+		pBitmap->Clear();
+		currentSize = size;
+		uPosition = 0;
+		entries.clear();
+		keyframes.clear();
+		keyframes[0].Size = size;
+		nextEntry = Entry();
+		chunk.clear();
+		cache.Clear();
+	}
+
+	// Changes the bitmap size, making newly exposed pixels white; unwritten bands already are
+	void Resize(SIZE size) {
+		const PBYTE pBits = pBitmap->GetBits();
+		const DWORD dwScanLineSize = pBitmap->GetScanLineSize();
+		if (size.cx > currentSize.cx)
+			for (LONG y = 0; y < size.cy; y++)
+				if (pBitmap->IsMaterialized(y))
+					FillMemory(pBits + currentSize.cx * dwPixelSize + y * dwScanLineSize, (size.cx - currentSize.cx) * dwPixelSize, 0xff);
+		if (size.cy > currentSize.cy)
+			for (LONG y = currentSize.cy; y < size.cy; y++)
+				if (pBitmap->IsMaterialized(y))
+					FillMemory(pBits + y * dwScanLineSize, min(size.cx, currentSize.cx) * dwPixelSize, 0xff);
+		currentSize = size;
+	}
+
+	// Adds a changed pixel to the entry that the next Push records
+	void AddPixel(const PIXEL& pixel) {
+		chunk.insert(chunk.end(), (LPCBYTE)&pixel, (LPCBYTE)(&pixel + 1));
+		if (++nextEntry.uPixelCount % HISTORY_CHUNK_SIZE == 0)
+			AddChunk();
+	}
+
+	// Records the pixels added since the last Push as an entry after the current state, dropping the entries after it
+	void Push(LPCWSTR lpcwName, SIZE sizeBefore, SIZE sizeAfter) {
+		for (size_t i = uPosition; i < entries.size(); i++)
+			RemoveChunks(entries[i]);
+		entries.erase(entries.begin() + uPosition, entries.end());
+		RemoveKeyframes(uPosition + 1);
+		AddChunk();
+		nextEntry.lpcwName = lpcwName;
+		nextEntry.SizeBefore = sizeBefore;
+		nextEntry.SizeAfter = sizeAfter;
+		entries.push_back(std::move(nextEntry));
+		nextEntry = Entry();
+		currentSize = sizeAfter;
+		if (++uPosition % HISTORY_KEYFRAME_INTERVAL == 0)
+			CaptureKeyframe();
+	}
+
+	// Moves the bitmap to the state after uTarget entries. Returns FALSE with the last error set if a payload cannot be
+	// read back from the scratch file; the bitmap may then be left partly between two states.
+	BOOL Jump(size_t uTarget) {
+		uTarget = min(uTarget, entries.size());
+		const size_t uLowerKeyframe = uTarget / HISTORY_KEYFRAME_INTERVAL * HISTORY_KEYFRAME_INTERVAL,
+			uUpperKeyframe = uLowerKeyframe + HISTORY_KEYFRAME_INTERVAL;
+		size_t uCost = GetDeltaCost(uPosition, uTarget), uBestKeyframe = SIZE_MAX;
+		for (const size_t uKeyframe : { uLowerKeyframe, uUpperKeyframe })
+			if (keyframes.count(uKeyframe)) {
+				const size_t uKeyframeCost = GetKeyframeCost(uKeyframe) + GetDeltaCost(uKeyframe, uTarget);
+				if (uKeyframeCost < uCost) {
+					uCost = uKeyframeCost;
+					uBestKeyframe = uKeyframe;
+				}
+			}
+		if (uBestKeyframe != SIZE_MAX && !RestoreKeyframe(uBestKeyframe))
+			return FALSE;
+		for (; uPosition < uTarget; uPosition++)
+			if (!Apply(entries[uPosition], TRUE))
+				return FALSE;
+		for (; uPosition > uTarget; uPosition--)
+			if (!Apply(entries[uPosition - 1], FALSE))
+				return FALSE;
+		return TRUE;
+	}
+
+	SIZE GetSize() const { return currentSize; }
+
+	size_t GetPosition() const { return uPosition; }
+
+	size_t GetCount() const { return entries.size(); }
+
+	LPCWSTR GetName(size_t uIndex) const { return entries[uIndex].lpcwName; }
+
+	CacheStatistics GetStatistics() const { return cache.GetStatistics(); }
+};
\ No newline at end of file
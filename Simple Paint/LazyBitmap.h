@@ -0,0 +1,222 @@
+#pragma once
+
+#include <Windows.h>
+#include <atomic>
+#include <list>
+#include <map>
+#include <memory>
+#include <vector>
+#include "SpillCache.h"
+
+#define LAZY_BITMAP_BAND_HEIGHT 16
+
+// Top-down 24-bit DIB memory whose pages are only touched when rows are first written. Rows are tracked in bands of
+// LAZY_BITMAP_BAND_HEIGHT; a band that has never been written is white without any memory behind it.
+// While a pending operation is open, the first write to each band saves its pre-image so the operation can be diffed or undone.
+// Pre-images count toward the memory budget; beyond half of it, the least recently used ones spill to a scratch file.
+// Written bands beyond the memory budget are evicted in least recently written order, never while they are being written:
+// their pages are written back to the file the memory is mapped from and trimmed from the working set of every view, so
+// they only stay in RAM as standby pages that the system can reuse, and are paged in again on the next access.
+class LazyBitmap {
+private:
+	static const DWORD dwPixelSize = 3;
+
+	PBYTE pBits = NULL, pAliasBits = NULL; // pAliasBits is another view of the same memory, if any
+	DWORD dwScanLineSize = 0;
+	LONG lHeight = 0;
+	size_t uBandCount = 0;
+	std::unique_ptr<std::atomic<bool>[]> materialized; // written by the render thread, read by the presenting thread
+	SIZE_T uBudget = SIZE_MAX, uResidentSize = 0;
+	std::list<size_t> lru; // resident bands, most recently written first
+	std::vector<std::list<size_t>::iterator> lruPositions;
+	std::vector<BYTE> resident;
+	std::atomic<ULONGLONG> ullHits { 0 }, ullMisses { 0 }, ullMissMicroseconds { 0 };
+	BOOL bPending = FALSE;
+	std::map<size_t, ULONGLONG> preImages; // band index -> payload id of its rows at the start of the pending operation; 0 if the band was white
+	SpillCache preImageCache;
+
+	LONG GetBandTop(size_t uBand) const { return (LONG)uBand * LAZY_BITMAP_BAND_HEIGHT; }
+
+	LONG GetBandBottom(size_t uBand) const { return min(GetBandTop(uBand) + LAZY_BITMAP_BAND_HEIGHT, lHeight); }
+
+	DWORD GetBandSize(size_t uBand) const { return (GetBandBottom(uBand) - GetBandTop(uBand)) * dwScanLineSize; }
+
+	void Admit(size_t uBand) {
+		lru.push_front(uBand);
+		lruPositions[uBand] = lru.begin();
+		resident[uBand] = TRUE;
+		uResidentSize += GetBandSize(uBand);
+	}
+
+	// Evicts bands until they and the resident pre-images fit the budget, except bands uFirst to uLast, which the current
+	// write has just moved to the front
+	void Trim(size_t uFirst, size_t uLast) {
+		while (uResidentSize + preImageCache.GetResidentSize() > uBudget && !lru.empty() && (lru.back() < uFirst || lru.back() > uLast))
+			Evict(lru.back());
+	}
+
+	void Evict(size_t uBand) {
+		const DWORD dwOffset = GetBandTop(uBand) * dwScanLineSize;
+		// Clean pages can be reused by the system as soon as they leave the working set; dirty ones would wait for the page writer
+		FlushViewOfFile(pBits + dwOffset, GetBandSize(uBand));
+		VirtualUnlock(pBits + dwOffset, GetBandSize(uBand)); // unlocking unlocked pages trims them
+		if (pAliasBits)
+			VirtualUnlock(pAliasBits + dwOffset, GetBandSize(uBand));
+		lru.erase(lruPositions[uBand]);
+		resident[uBand] = FALSE;
+		uResidentSize -= GetBandSize(uBand);
+	}
+
+	// Faults the band's pages back in so that the cost of a miss is measured in one place
+	void PageIn(size_t uBand) {
+		LARGE_INTEGER startTime;
+		QueryPerformanceCounter(&startTime);
+		const volatile BYTE* pBand = pBits + GetBandTop(uBand) * dwScanLineSize;
+		for (DWORD i = 0; i < GetBandSize(uBand); i += 0x1000)
+			(void)pBand[i];
+		ullMisses++;
+		ullMissMicroseconds += GetElapsedMicroseconds(startTime.QuadPart);
+	}
+
+public:
+	void Reset(PBYTE pBits, DWORD dwScanLineSize, LONG lHeight, SIZE_T uMemoryBudget) {
+		this->pBits = pBits;
+		this->dwScanLineSize = dwScanLineSize;
+		this->lHeight = lHeight;
+		uBudget = uMemoryBudget;
+		uBandCount = (lHeight + LAZY_BITMAP_BAND_HEIGHT - 1) / LAZY_BITMAP_BAND_HEIGHT;
+		materialized.reset(new std::atomic<bool>[uBandCount]);
+		for (size_t i = 0; i < uBandCount; i++)
+			materialized[i] = false;
+		lru.clear();
+		lruPositions.resize(uBandCount);
+		resident.assign(uBandCount, FALSE);
+		uResidentSize = 0;
+		preImageCache.SetBudget(uMemoryBudget / 2);
+		EndPending();
+		Clear();
+	}
+
+	// Another view of the memory, such as one that the presenting thread reads through; its pages are trimmed along with evicted bands
+	void SetAlias(PBYTE pAliasBits) { this->pAliasBits = pAliasBits; }
+
+	PBYTE GetBits() const { return pBits; }
+
+	DWORD GetScanLineSize() const { return dwScanLineSize; }
+
+	size_t GetBand(LONG y) const { return y / LAZY_BITMAP_BAND_HEIGHT; }
+
+	BOOL IsMaterialized(LONG y) const { return materialized[GetBand(y)].load(std::memory_order_acquire); }
+
+	// Turns every band white again and drops its pages from the working set
+	void Clear() {
+		for (size_t i = 0; i < uBandCount; i++)
+			Discard(i);
+	}
+
+	void Discard(size_t uBand) {
+		if (materialized[uBand].exchange(false) && resident[uBand])
+			Evict(uBand);
+	}
+
+	// Must be called before rows [lTop, lBottom) are written
+	void Write(LONG lTop, LONG lBottom) {
+		lTop = max(lTop, 0);
+		lBottom = min(lBottom, lHeight);
+		if (lTop >= lBottom)
+			return;
+		const size_t uFirst = GetBand(lTop), uLast = GetBand(lBottom - 1);
+		for (size_t i = uFirst; i <= uLast; i++) {
+			const PBYTE pBand = pBits + GetBandTop(i) * dwScanLineSize;
+			const BOOL bMaterialized = materialized[i].load(std::memory_order_relaxed);
+			if (!bMaterialized || !resident[i]) {
+				if (bMaterialized)
+					PageIn(i);
+				Admit(i);
+			}
+			else {
+				ullHits++;
+				if (lru.front() != i)
+					lru.splice(lru.begin(), lru, lruPositions[i]);
+			}
+			if (bPending && !preImages.count(i))
+				preImages[i] = bMaterialized ? preImageCache.Add(std::vector<BYTE>(pBand, pBand + GetBandSize(i))) : 0;
+			if (!bMaterialized) {
+				FillMemory(pBand, GetBandSize(i), 0xff);
+				materialized[i].store(true, std::memory_order_release);
+			}
+		}
+		Trim(uFirst, uLast);
+	}
+
+	void BeginPending() {
+		EndPending();
+		bPending = TRUE;
+	}
+
+	BOOL IsPending() const { return bPending; }
+
+	// Bands written since BeginPending, with the payload ids of their pre-images for GetPreImage
+	const std::map<size_t, ULONGLONG>& GetPreImages() const { return preImages; }
+
+	// The rows of a band at BeginPending; NULL with the last error set if they cannot be read back from the scratch file.
+	// The pointer stays valid until the next call that writes rows or reads a pre-image.
+	const std::vector<BYTE>* GetPreImage(ULONGLONG ullPreImage) { return preImageCache.Get(ullPreImage); }
+
+	void EndPending() {
+		preImages.clear();
+		preImageCache.Clear();
+		bPending = FALSE;
+	}
+
+	// Restores every band written since BeginPending and ends the pending operation. Returns FALSE with the last error set
+	// if a pre-image cannot be read back; that band is left as it is.
+	BOOL CancelPending() {
+		DWORD dwLastError = ERROR_SUCCESS;
+		for (const auto& preImage : preImages)
+			if (!preImage.second)
+				Discard(preImage.first);
+			else if (const std::vector<BYTE>* pPreImage = preImageCache.Get(preImage.second))
+				CopyMemory(pBits + GetBandTop(preImage.first) * dwScanLineSize, pPreImage->data(), pPreImage->size());
+			else
+				dwLastError = GetLastError();
+		EndPending();
+		SetLastError(dwLastError);
+		return dwLastError == ERROR_SUCCESS;
+	}
+
+	// Asks the memory manager to read back the written bands among rows [lTop, lBottom) ahead of use; callable from any thread
+	void Prefetch(LONG lTop, LONG lBottom) const {
+		std::vector<WIN32_MEMORY_RANGE_ENTRY> ranges;
+		lBottom = min(lBottom, lHeight);
+		for (size_t i = GetBand(max(lTop, 0L)); GetBandTop(i) < lBottom; i++)
+			if (materialized[i].load(std::memory_order_acquire)) {
+				const PBYTE pBand = pBits + GetBandTop(i) * dwScanLineSize;
+				if (!ranges.empty() && (PBYTE)ranges.back().VirtualAddress + ranges.back().NumberOfBytes == pBand)
+					ranges.back().NumberOfBytes += GetBandSize(i);
+				else
+					ranges.push_back({ pBand, GetBandSize(i) });
+			}
+		if (!ranges.empty())
+			PrefetchVirtualMemory(GetCurrentProcess(), ranges.size(), ranges.data(), 0);
+	}
+
+	CacheStatistics GetStatistics() const { return { ullHits, ullMisses, ullMissMicroseconds }; }
+
+	// Copies rect to (iX, iY) of hDC_Target from hDC_Source, which must have this memory selected; unwritten bands are painted white
+	void Copy(HDC hDC_Target, int iX, int iY, HDC hDC_Source, const RECT& rect) const {
+		const LONG lBottom = min(rect.bottom, lHeight);
+		for (LONG y = max(rect.top, 0L); y < lBottom;) {
+			const BOOL bMaterialized = IsMaterialized(y);
+			LONG lRunBottom = y;
+			do
+				lRunBottom = min(GetBandBottom(GetBand(lRunBottom)), lBottom);
+			while (lRunBottom < lBottom && IsMaterialized(lRunBottom) == bMaterialized);
+			if (bMaterialized)
+				BitBlt(hDC_Target, iX, iY + y - rect.top, rect.right - rect.left, lRunBottom - y, hDC_Source, rect.left, y, SRCCOPY);
+			else
+				PatBlt(hDC_Target, iX, iY + y - rect.top, rect.right - rect.left, lRunBottom - y, WHITENESS);
+			y = lRunBottom;
+		}
+	}
+};
\ No newline at end of file
@@ -6,12 +6,16 @@ This project is hosted on https://github.com/Hydr10n/Simple-Paint
 Copyright (C) Programmer-Yang_Xun@outlook.com. All Rights Reserved.
 */
 
+#include <algorithm>
 #include <memory>
 #include <vector>
-#include <stack>
 #include <string>
 #include "resource.h"
 #include "About.h"
+#include "Diagnostics.h"
+#include "Renderer.h"
+#include "Sync.h"
+#include "TimeLapse.h"
 #include "Utilities.h"
 
 #define APP_NAME L"Simple Paint"
@@ -19,60 +23,203 @@ Copyright (C) Programmer-Yang_Xun@outlook.com. All Rights Reserved.
 #define DEFAULT_FILE_TITLE L"Untitled"
 #define UNSAVE_FILE_PROMPT L"Do you want to save changes to "
 #define SAVE_FILE_FAIL_PROMPT L"Failed to save changes due to the following reason:\n"
+#define EXPORT_FAIL_PROMPT L"Failed to export the time-lapse due to the following reason:\n"
+#define SYNC_FAIL_PROMPT L"Failed to join the shared canvas due to the following reason:\n"
+#define HISTORY_FAIL_PROMPT L"Failed to read back the history due to the following reason:\n"
 
 #define MAIN_WINDOW_WIDTH 1350
 #define MAIN_WINDOW_HEIGHT 850
 #define CANVAS_WIDTH 1280
 #define CANVAS_HEIGHT 720
+#ifdef _WIN64
+#define CANVAS_MAX_WIDTH 24576
+#define CANVAS_MAX_HEIGHT 24576
+#else
+#define CANVAS_MAX_WIDTH 8192
+#define CANVAS_MAX_HEIGHT 8192
+#endif
 #define CANVAS_LEFT 3
 #define CANVAS_TOP CANVAS_LEFT
 #define CANVAS_PADDING 3
 #define CANVAS_MARGIN 7
 #define CANVAS_SHADOW_OFFSET 5
 #define CANVAS_SHADOW_LENGTH 4
+#define HISTORY_PANEL_WIDTH 160
+#define HISTORY_INITIAL_STATE_NAME L"New Canvas"
 #define PEN_WIDTH_1PX 1
 #define PEN_WIDTH_2PX 2
 #define PEN_WIDTH_4PX 4
 #define PEN_WIDTH_8PX 8
+#define PEN_WIDTH_16PX 16
+#define PEN_WIDTH_32PX 32
+#define PEN_WIDTH_64PX 64
+#define PEN_WIDTH_128PX 128
+#define PEN_WIDTH_256PX 256
 #define ERASER_WIDTH_1PX PEN_WIDTH_1PX
 #define ERASER_WIDTH_2PX PEN_WIDTH_2PX
 #define ERASER_WIDTH_4PX PEN_WIDTH_4PX
 #define ERASER_WIDTH_8PX PEN_WIDTH_8PX
+#define ERASER_WIDTH_16PX PEN_WIDTH_16PX
+#define ERASER_WIDTH_32PX PEN_WIDTH_32PX
+#define ERASER_WIDTH_64PX PEN_WIDTH_64PX
+#define ERASER_WIDTH_128PX PEN_WIDTH_128PX
+#define ERASER_WIDTH_256PX PEN_WIDTH_256PX
+#define BRUSH_HARDNESS_HARD 0xff
+#define BRUSH_HARDNESS_MEDIUM 0x80
+#define BRUSH_HARDNESS_SOFT 0
+#define BRUSH_SPACING_5 0.05f
+#define BRUSH_SPACING_10 0.1f
+#define BRUSH_SPACING_25 0.25f
+#define BRUSH_SPACING_50 0.5f
+#define MAX_POINTER_PRESSURE 1024.0f
+#define TEXT_DEFAULT_HEIGHT 24
+#define MEMORY_BUDGET_MB 512
+#define MEMORY_BUDGET_SWITCH L"/budget:"
 
 using std::auto_ptr;
 using std::vector;
-using std::stack;
 using std::wstring;
 using std::to_wstring;
 
-struct PIXEL {
-	DWORD dwDIBSectionIndex;
-	RGBQUAD Rgbq;
-};
+enum class PaintingTools { Pen = IDM_PEN, Eraser = IDM_ERASER, Fill = IDM_FILL, Line = IDM_LINE, Rectangle = IDM_RECTANGLE, Ellipse = IDM_ELLIPSE, Text = IDM_TEXT, ColorPicker = IDM_COLORPICKER };
 
-struct PartialBitmap {
-	SIZE Size;
-	vector<PIXEL> Pixels;
-};
-
-enum class PaintingTools { Pen = IDM_PEN, Eraser = IDM_ERASER, Fill = IDM_FILL, ColorPicker = IDM_COLORPICKER };
-
-BOOL bFileSaved = TRUE;
+BOOL bFileSaved = TRUE, bFillShapes, bTyping;
 int iDPI = USER_DEFAULT_SCREEN_DPI, iPenWidth = PEN_WIDTH_8PX, iEraserWidth = ERASER_WIDTH_8PX, iActualMargin;
+BYTE bBrushHardness = BRUSH_HARDNESS_HARD;
+float fBrushSpacing = BRUSH_SPACING_10;
+SIZE_T uMemoryBudget = (SIZE_T)MEMORY_BUDGET_MB << 20;
 PaintingTools paintingTool = PaintingTools::Pen, previousPaintingTool = paintingTool;
 COLORREF penColor = RGB(0, 128, 192);
+LOGFONTW logFont_Text;
+TextFont textFont;
+wstring typedText; // mirrors the text being typed, which only the render thread lays out
+POINT textOrigin;
 SIZE currentScroll, maxBitmapSize, canvasSize;
-HWND hWnd_StatusBar;
+HWND hWnd_StatusBar, hWnd_History;
+Diagnostics diagnostics;
 HMENU hMenu;
-HDC hDC_Canvas, hDC_Memory;
-stack<PartialBitmap> undoHistory, redoHistory;
+HDC hDC_Canvas;
+HFONT hFont_Text;
+Renderer renderer;
+TimeLapseExporter timeLapseExporter;
+SyncReplica replica;
+size_t uHistoryPosition, uHistoryCount; // mirrors the renderer's history, which only the render thread touches
+size_t uHistoryVersion; // history changes since the last Clear, which every replica of a shared canvas counts alike
 
 LRESULT CALLBACK WndProc_Main(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam);
 LRESULT CALLBACK WndProc_PaintView(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam);
 LRESULT CALLBACK WndProc_Canvas(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam);
 
+LPCWSTR GetPaintingToolName(PaintingTools paintingTool) {
+	switch (paintingTool) {
+	case PaintingTools::Pen: return L"Pen";
+	case PaintingTools::Eraser: return L"Eraser";
+	case PaintingTools::Fill: return L"Fill";
+	case PaintingTools::Line: return L"Line";
+	case PaintingTools::Rectangle: return L"Rectangle";
+	case PaintingTools::Ellipse: return L"Ellipse";
+	case PaintingTools::Text: return L"Text";
+	}
+	return NULL;
+}
+
+LONGLONG GetInputTime() {
+	LARGE_INTEGER counter;
+	QueryPerformanceCounter(&counter);
+	return counter.QuadPart;
+}
+
+void CopyCanvas(HDC hDC_Target, int iX, int iY, const RECT& rect) { renderer.Copy(hDC_Target, iX, iY, rect); }
+
+void UpdateHistoryState() {
+	SendMessageW(hWnd_History, LB_SETCURSEL, uHistoryPosition, 0);
+	EnableMenuItem(hMenu, IDM_UNDO, uHistoryPosition ? MF_ENABLED : MF_DISABLED);
+	EnableMenuItem(hMenu, IDM_REDO, uHistoryPosition < uHistoryCount ? MF_ENABLED : MF_DISABLED);
+}
+
+void ClearHistory() {
+	uHistoryPosition = uHistoryCount = uHistoryVersion = 0;
+	SendMessageW(hWnd_History, LB_RESETCONTENT, 0, 0);
+	SendMessageW(hWnd_History, LB_ADDSTRING, 0, (LPARAM)HISTORY_INITIAL_STATE_NAME);
+	UpdateHistoryState();
+}
+
+// Called for every submitted command that makes the renderer push a history entry
+void PushHistory(LPCWSTR lpcwName) {
+	bFileSaved = FALSE;
+	for (LRESULT lCount = SendMessageW(hWnd_History, LB_GETCOUNT, 0, 0); lCount > (LRESULT)uHistoryPosition + 1; lCount--)
+		SendMessageW(hWnd_History, LB_DELETESTRING, lCount - 1, 0);
+	SendMessageW(hWnd_History, LB_ADDSTRING, 0, (LPARAM)lpcwName);
+	uHistoryCount = ++uHistoryPosition;
+	uHistoryVersion++;
+	UpdateHistoryState();
+}
+
+// Renders a command in its final order and mirrors its effect on the history
+void ApplyCommand(const RenderCommand& command) {
+	// On a shared canvas, history changes ordered ahead of a jump would make it undo or redo something else than was chosen
+	if (command.Type == RenderCommandTypes::Jump && command.uBaseVersion != uHistoryVersion) {
+		UpdateHistoryState();
+		return;
+	}
+	renderer.Submit(command);
+	switch (command.Type) {
+	case RenderCommandTypes::Commit: case RenderCommandTypes::DrawShape: PushHistory(command.lpcwName); break;
+	case RenderCommandTypes::Resize: PushHistory(L"Resize"); break;
+	case RenderCommandTypes::Jump: {
+		bFileSaved = FALSE;
+		uHistoryPosition = command.uTarget;
+		uHistoryVersion++;
+		UpdateHistoryState();
+	}	break;
+	case RenderCommandTypes::Clear: ClearHistory(); break;
+	}
+}
+
+// Every command from user input goes through here; on a shared canvas it is ordered by the coordinator first
+void IssueCommand(const RenderCommand& command) {
+	if (replica.IsJoined())
+		replica.Issue(command);
+	else
+		ApplyCommand(command);
+}
+
+void SetTextFont(const LOGFONTW& logFont) {
+	logFont_Text = logFont;
+	textFont = { OpLog::Intern(logFont.lfFaceName), abs(logFont.lfHeight), logFont.lfWeight, logFont.lfItalic };
+}
+
+// Places the caret after the last typed character; GDI measures text the same way glyphs are advanced in the atlas
+void UpdateTextCaret() {
+	const size_t uLineStart = typedText.rfind(L'\n') + 1;
+	HFONT hFont_Old = SelectFont(hDC_Canvas, hFont_Text);
+	TEXTMETRICW textMetric;
+	SIZE extent;
+	GetTextMetricsW(hDC_Canvas, &textMetric);
+	GetTextExtentPoint32W(hDC_Canvas, typedText.c_str() + uLineStart, (int)(typedText.size() - uLineStart), &extent);
+	SelectFont(hDC_Canvas, hFont_Old);
+	SetCaretPos(textOrigin.x + extent.cx, textOrigin.y + (LONG)std::count(typedText.cbegin(), typedText.cend(), L'\n') * textMetric.tmHeight);
+}
+
+// Commits the text being typed as one history entry, or cancels it if nothing was typed
+void EndText() {
+	if (!bTyping)
+		return;
+	bTyping = FALSE;
+	const RenderCommand command = { typedText.empty() ? RenderCommandTypes::Cancel : RenderCommandTypes::Commit, GetInputTime(), GetPaintingToolName(PaintingTools::Text) };
+	IssueCommand(command);
+	typedText.clear();
+	DestroyCaret();
+	DeleteFont(hFont_Text);
+}
+
 int APIENTRY wWinMain(HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance, LPWSTR lpCmdLine, int nShowCmd) {
 	UNREFERENCED_PARAMETER(hPrevInstance);
+	if (wcsstr(lpCmdLine, SYNC_COORDINATOR_SWITCH))
+		return SyncCoordinator().Run();
+	LPCWSTR lpcwMemoryBudget = wcsstr(lpCmdLine, MEMORY_BUDGET_SWITCH);
+	if (lpcwMemoryBudget && _wtoi(lpcwMemoryBudget + wcslen(MEMORY_BUDGET_SWITCH)) > 0)
+		uMemoryBudget = (SIZE_T)_wtoi(lpcwMemoryBudget + wcslen(MEMORY_BUDGET_SWITCH)) << 20;
 	SIZE size = { MAIN_WINDOW_WIDTH, MAIN_WINDOW_HEIGHT };
 	HDC hDC = GetDC(NULL);
 	if (hDC) {
@@ -100,10 +247,12 @@ int APIENTRY wWinMain(HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance, LPW
 		NULL, NULL, hInstance, NULL);
 	ShowWindow(hWnd, nShowCmd);
 	UpdateWindow(hWnd);
+	if (wcsstr(lpCmdLine, SYNC_JOIN_SWITCH))
+		PostMessageW(hWnd, WM_COMMAND, IDM_SHAREDCANVAS, 0);
 	HACCEL hAccel = LoadAcceleratorsW(hInstance, MAKEINTRESOURCEW(IDR_ACCELERATOR));
 	MSG msg;
 	while (GetMessageW(&msg, NULL, 0, 0))
-		if (!TranslateAcceleratorW(hWnd, hAccel, &msg)) {
+		if (!diagnostics.TranslateDialogMessage(&msg) && !TranslateAcceleratorW(hWnd, hAccel, &msg)) {
 			TranslateMessage(&msg);
 			DispatchMessageW(&msg);
 		}
@@ -117,10 +266,11 @@ LRESULT CALLBACK WndProc_Main(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam
 	static WCHAR szFileName[MAX_PATH] = DEFAULT_FILE_TITLE;
 	static HWND hWnd_PaintView;
 	static HBRUSH hBrush_Background;
+	static HFONT hFont_History;
 	switch (uMsg) {
 	case WM_CREATE: {
 		const HINSTANCE hInstance = ((LPCREATESTRUCTW)lParam)->hInstance;
-		const INT uParts[] = { Scale(200, iDPI), Scale(400, iDPI) };
+		const INT uParts[] = { Scale(200, iDPI), Scale(400, iDPI), -1 };
 		iActualMargin = Scale(CANVAS_MARGIN + CANVAS_PADDING, iDPI);
 		hWnd_StatusBar = CreateWindowW(STATUSCLASSNAMEW, NULL,
 			WS_CHILD | WS_VISIBLE | SBARS_SIZEGRIP,
@@ -130,6 +280,18 @@ LRESULT CALLBACK WndProc_Main(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam
 		GetWindowRect(hWnd_StatusBar, &statusBarRect);
 		lStatusBarHeight = statusBarRect.bottom - statusBarRect.top;
 		SendMessageW(hWnd_StatusBar, SB_SETPARTS, _countof(uParts), (LPARAM)uParts);
+		diagnostics.Create(hWnd_StatusBar, _countof(uParts) - 1);
+		hWnd_History = CreateWindowExW(WS_EX_CLIENTEDGE, WC_LISTBOXW, NULL,
+			WS_CHILD | WS_VISIBLE | WS_VSCROLL | LBS_NOTIFY | LBS_NOINTEGRALHEIGHT,
+			0, 0, 0, 0,
+			hWnd, (HMENU)ID_HISTORY, hInstance, NULL);
+		NONCLIENTMETRICSW nonClientMetrics = { sizeof(nonClientMetrics) };
+		SystemParametersInfoW(SPI_GETNONCLIENTMETRICS, sizeof(nonClientMetrics), &nonClientMetrics, 0);
+		hFont_History = CreateFontIndirectW(&nonClientMetrics.lfMessageFont);
+		SetWindowFont(hWnd_History, hFont_History, FALSE);
+		LOGFONTW logFont = nonClientMetrics.lfMessageFont;
+		logFont.lfHeight = -Scale(TEXT_DEFAULT_HEIGHT, iDPI);
+		SetTextFont(logFont);
 		WNDCLASSW wndClass = { 0 };
 		wndClass.hInstance = hInstance;
 		wndClass.lpszClassName = L"PaintView";
@@ -143,13 +305,18 @@ LRESULT CALLBACK WndProc_Main(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam
 			hWnd, NULL, hInstance, NULL);
 		hMenu = GetMenu(hWnd);
 		CheckMenuRadioItem(hMenu, IDM_PEN, IDM_COLORPICKER, IDM_PEN, MF_BYCOMMAND);
-		CheckMenuRadioItem(hMenu, IDM_PENSIZE_1PX, IDM_PENSIZE_8PX, IDM_PENSIZE_8PX, MF_BYCOMMAND);
-		CheckMenuRadioItem(hMenu, IDM_ERASERSIZE_1PX, IDM_ERASERSIZE_8PX, IDM_ERASERSIZE_8PX, MF_BYCOMMAND);
+		CheckMenuRadioItem(hMenu, IDM_PENSIZE_1PX, IDM_PENSIZE_256PX, IDM_PENSIZE_8PX, MF_BYCOMMAND);
+		CheckMenuRadioItem(hMenu, IDM_ERASERSIZE_1PX, IDM_ERASERSIZE_256PX, IDM_ERASERSIZE_8PX, MF_BYCOMMAND);
+		CheckMenuRadioItem(hMenu, IDM_BRUSHHARDNESS_HARD, IDM_BRUSHHARDNESS_SOFT, IDM_BRUSHHARDNESS_HARD, MF_BYCOMMAND);
+		CheckMenuRadioItem(hMenu, IDM_BRUSHSPACING_5, IDM_BRUSHSPACING_50, IDM_BRUSHSPACING_10, MF_BYCOMMAND);
+		CheckMenuRadioItem(hMenu, IDM_SHAPESTYLE_OUTLINE, IDM_SHAPESTYLE_FILLED, IDM_SHAPESTYLE_OUTLINE, MF_BYCOMMAND);
 	}	break;
 	case WM_GETMINMAXINFO: ((LPMINMAXINFO)lParam)->ptMinTrackSize = { Scale(230, iDPI), Scale(230, iDPI) }; return 0;
 	case WM_SIZE: {
 		SetWindowPos(hWnd_StatusBar, NULL, 0, 0, 0, 0, SWP_NOZORDER);
-		SetWindowPos(hWnd_PaintView, NULL, 0, 0, LOWORD(lParam), HIWORD(lParam) - lStatusBarHeight, SWP_NOZORDER);
+		const int iHistoryPanelWidth = min(Scale(HISTORY_PANEL_WIDTH, iDPI), LOWORD(lParam) / 2);
+		SetWindowPos(hWnd_PaintView, NULL, 0, 0, LOWORD(lParam) - iHistoryPanelWidth, HIWORD(lParam) - lStatusBarHeight, SWP_NOZORDER);
+		SetWindowPos(hWnd_History, NULL, LOWORD(lParam) - iHistoryPanelWidth, 0, iHistoryPanelWidth, HIWORD(lParam) - lStatusBarHeight, SWP_NOZORDER);
 	}	break;
 	case WM_COMMAND: {
 		const WORD wParamLow = LOWORD(wParam);
@@ -166,13 +333,10 @@ LRESULT CALLBACK WndProc_Main(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam
 				}
 			else {
 			discard:;
-				RECT rect = { 0, 0, canvasSize.cx, canvasSize.cy };
-				FillRect(hDC_Canvas, &rect, SYS_WHITE_BRUSH);
-				FillRect(hDC_Memory, &rect, SYS_WHITE_BRUSH);
-				undoHistory = decltype(undoHistory)();
-				redoHistory = decltype(redoHistory)();
-				EnableMenuItem(hMenu, IDM_UNDO, MF_DISABLED);
-				EnableMenuItem(hMenu, IDM_REDO, MF_DISABLED);
+				EndText();
+				RenderCommand command = { RenderCommandTypes::Clear, GetInputTime() };
+				command.Size = canvasSize;
+				IssueCommand(command);
 			}
 		}	break;
 		case IDA_NEWWINDOW: {
@@ -185,14 +349,16 @@ LRESULT CALLBACK WndProc_Main(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam
 			startupInfo.dwX = rect.left;
 			startupInfo.dwY = rect.top;
 			PROCESS_INFORMATION processInfo;
-			CreateProcessW(szProgramFileName, NULL, NULL, NULL, FALSE, 0, NULL, NULL, &startupInfo, &processInfo);
+			wstring commandLine = L'"' + wstring(szProgramFileName) + L"\" " + (replica.IsJoined() ? SYNC_JOIN_SWITCH : L"");
+			CreateProcessW(szProgramFileName, &commandLine[0], NULL, NULL, FALSE, 0, NULL, NULL, &startupInfo, &processInfo);
 			CloseHandle(processInfo.hProcess);
 			CloseHandle(processInfo.hThread);
 		}	break;
 		case IDA_SAVE: {
 			if (!bFileEverSaved)
 				goto saveAs;
-			if (SaveDCAs24bitBitmapFile(szFileName, hDC_Memory, canvasSize.cx, canvasSize.cy))
+			renderer.Flush();
+			if (SaveAs24bitBitmapFile(szFileName, CopyCanvas, canvasSize.cx, canvasSize.cy))
 				bFileSaved = bFileEverSaved = TRUE;
 			else
 				MessageBoxW(hWnd,
@@ -210,8 +376,9 @@ LRESULT CALLBACK WndProc_Main(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam
 			openFileName.lpstrFilter = L"24-bit Bitmap (*.bmp)\0";
 			openFileName.lpstrDefExt = L"bmp";
 			openFileName.Flags = OFN_PATHMUSTEXIST | OFN_FILEMUSTEXIST | OFN_OVERWRITEPROMPT;
-			if (GetSaveFileNameW(&openFileName))
-				if (SaveDCAs24bitBitmapFile(szFileName, hDC_Memory, canvasSize.cx, canvasSize.cy)) {
+			if (GetSaveFileNameW(&openFileName)) {
+				renderer.Flush();
+				if (SaveAs24bitBitmapFile(szFileName, CopyCanvas, canvasSize.cx, canvasSize.cy)) {
 					bFileSaved = bFileEverSaved = TRUE;
 					PathRemoveExtensionW(szFileTitle);
 					SetWindowTextW(hWnd, (szFileTitle + wstring(WINDOW_TITLE_SUFFIX)).c_str());
@@ -220,26 +387,73 @@ LRESULT CALLBACK WndProc_Main(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam
 					MessageBoxW(hWnd,
 					(wstring(SAVE_FILE_FAIL_PROMPT) + SysErrorMsg(GetLastError()).GetMsg()).c_str(), NULL,
 						MB_OK | MB_ICONERROR);
+			}
 			else
 				return 1;
 		}	break;
+		case IDM_EXPORTTIMELAPSE: {
+			static TimeLapseSettings settings = { TIMELAPSE_DEFAULT_FRAME_RATE, TIMELAPSE_DEFAULT_SPEED };
+			if (timeLapseExporter.IsRunning() ||
+				DialogBoxParamW(GetModuleHandle(NULL), MAKEINTRESOURCEW(IDD_DIALOG_TIMELAPSE), hWnd, DlgProc_TimeLapse, (LPARAM)&settings) != IDOK)
+				break;
+			WCHAR szExportFileName[MAX_PATH] = L"";
+			OPENFILENAMEW openFileName = { sizeof(openFileName) };
+			openFileName.hwndOwner = hWnd;
+			openFileName.lpstrFile = szExportFileName;
+			openFileName.nMaxFile = _countof(szExportFileName);
+			openFileName.lpstrFilter = L"Uncompressed AVI Video (*.avi)\0*.avi\0Bitmap Sequence (*.bmp)\0*.bmp\0";
+			openFileName.lpstrDefExt = L"avi";
+			openFileName.Flags = OFN_PATHMUSTEXIST | OFN_OVERWRITEPROMPT;
+			if (!GetSaveFileNameW(&openFileName))
+				break;
+			renderer.Flush();
+			if (timeLapseExporter.Start(hWnd, renderer.GetOpLog(), maxBitmapSize, canvasSize, uMemoryBudget, settings, szExportFileName,
+				openFileName.nFilterIndex == 2 ? TimeLapseFormats::BitmapSequence : TimeLapseFormats::AVI))
+				EnableMenuItem(hMenu, IDM_EXPORTTIMELAPSE, MF_DISABLED);
+			else
+				MessageBoxW(hWnd, (wstring(EXPORT_FAIL_PROMPT) + SysErrorMsg(GetLastError()).GetMsg()).c_str(), NULL, MB_OK | MB_ICONERROR);
+		}	break;
 		case IDM_EXIT: PostMessage(hWnd, WM_CLOSE, 0, 0); break;
-		case IDM_PEN: case IDM_ERASER: case IDM_FILL: case IDM_COLORPICKER: {
+		case IDM_PEN: case IDM_ERASER: case IDM_FILL: case IDM_LINE: case IDM_RECTANGLE: case IDM_ELLIPSE: case IDM_TEXT: case IDM_COLORPICKER: {
+			EndText();
 			CheckMenuRadioItem(hMenu, IDM_PEN, IDM_COLORPICKER, wParamLow, MF_BYCOMMAND);
 			paintingTool = (PaintingTools)wParamLow;
 			if (wParamLow != IDM_COLORPICKER)
 				previousPaintingTool = paintingTool;
 		}	break;
-		case IDM_PENSIZE_1PX: iPenWidth = PEN_WIDTH_1PX; goto pensize_8px;
-		case IDM_PENSIZE_2PX: iPenWidth = PEN_WIDTH_2PX; goto pensize_8px;
-		case IDM_PENSIZE_4PX: iPenWidth = PEN_WIDTH_4PX; goto pensize_8px;
-		case IDM_PENSIZE_8PX: iPenWidth = PEN_WIDTH_8PX;
-		pensize_8px:; CheckMenuRadioItem(hMenu, IDM_PENSIZE_1PX, IDM_PENSIZE_8PX, wParamLow, MF_BYCOMMAND); break;
-		case IDM_ERASERSIZE_1PX: iEraserWidth = ERASER_WIDTH_1PX; goto erasersize_8px;
-		case IDM_ERASERSIZE_2PX: iEraserWidth = ERASER_WIDTH_2PX; goto erasersize_8px;
-		case IDM_ERASERSIZE_4PX: iEraserWidth = ERASER_WIDTH_4PX; goto erasersize_8px;
-		case IDM_ERASERSIZE_8PX: iEraserWidth = ERASER_WIDTH_8PX;
-		erasersize_8px:; CheckMenuRadioItem(hMenu, IDM_ERASERSIZE_1PX, IDM_ERASERSIZE_8PX, wParamLow, MF_BYCOMMAND); break;
+		case IDM_PENSIZE_1PX: iPenWidth = PEN_WIDTH_1PX; goto pensize_256px;
+		case IDM_PENSIZE_2PX: iPenWidth = PEN_WIDTH_2PX; goto pensize_256px;
+		case IDM_PENSIZE_4PX: iPenWidth = PEN_WIDTH_4PX; goto pensize_256px;
+		case IDM_PENSIZE_8PX: iPenWidth = PEN_WIDTH_8PX; goto pensize_256px;
+		case IDM_PENSIZE_16PX: iPenWidth = PEN_WIDTH_16PX; goto pensize_256px;
+		case IDM_PENSIZE_32PX: iPenWidth = PEN_WIDTH_32PX; goto pensize_256px;
+		case IDM_PENSIZE_64PX: iPenWidth = PEN_WIDTH_64PX; goto pensize_256px;
+		case IDM_PENSIZE_128PX: iPenWidth = PEN_WIDTH_128PX; goto pensize_256px;
+		case IDM_PENSIZE_256PX: iPenWidth = PEN_WIDTH_256PX;
+		pensize_256px:; CheckMenuRadioItem(hMenu, IDM_PENSIZE_1PX, IDM_PENSIZE_256PX, wParamLow, MF_BYCOMMAND); break;
+		case IDM_ERASERSIZE_1PX: iEraserWidth = ERASER_WIDTH_1PX; goto erasersize_256px;
+		case IDM_ERASERSIZE_2PX: iEraserWidth = ERASER_WIDTH_2PX; goto erasersize_256px;
+		case IDM_ERASERSIZE_4PX: iEraserWidth = ERASER_WIDTH_4PX; goto erasersize_256px;
+		case IDM_ERASERSIZE_8PX: iEraserWidth = ERASER_WIDTH_8PX; goto erasersize_256px;
+		case IDM_ERASERSIZE_16PX: iEraserWidth = ERASER_WIDTH_16PX; goto erasersize_256px;
+		case IDM_ERASERSIZE_32PX: iEraserWidth = ERASER_WIDTH_32PX; goto erasersize_256px;
+		case IDM_ERASERSIZE_64PX: iEraserWidth = ERASER_WIDTH_64PX; goto erasersize_256px;
+		case IDM_ERASERSIZE_128PX: iEraserWidth = ERASER_WIDTH_128PX; goto erasersize_256px;
+		case IDM_ERASERSIZE_256PX: iEraserWidth = ERASER_WIDTH_256PX;
+		erasersize_256px:; CheckMenuRadioItem(hMenu, IDM_ERASERSIZE_1PX, IDM_ERASERSIZE_256PX, wParamLow, MF_BYCOMMAND); break;
+		case IDM_BRUSHHARDNESS_HARD: bBrushHardness = BRUSH_HARDNESS_HARD; goto brushhardness_soft;
+		case IDM_BRUSHHARDNESS_MEDIUM: bBrushHardness = BRUSH_HARDNESS_MEDIUM; goto brushhardness_soft;
+		case IDM_BRUSHHARDNESS_SOFT: bBrushHardness = BRUSH_HARDNESS_SOFT;
+		brushhardness_soft:; CheckMenuRadioItem(hMenu, IDM_BRUSHHARDNESS_HARD, IDM_BRUSHHARDNESS_SOFT, wParamLow, MF_BYCOMMAND); break;
+		case IDM_BRUSHSPACING_5: fBrushSpacing = BRUSH_SPACING_5; goto brushspacing_50;
+		case IDM_BRUSHSPACING_10: fBrushSpacing = BRUSH_SPACING_10; goto brushspacing_50;
+		case IDM_BRUSHSPACING_25: fBrushSpacing = BRUSH_SPACING_25; goto brushspacing_50;
+		case IDM_BRUSHSPACING_50: fBrushSpacing = BRUSH_SPACING_50;
+		brushspacing_50:; CheckMenuRadioItem(hMenu, IDM_BRUSHSPACING_5, IDM_BRUSHSPACING_50, wParamLow, MF_BYCOMMAND); break;
+		case IDM_SHAPESTYLE_OUTLINE: case IDM_SHAPESTYLE_FILLED: {
+			CheckMenuRadioItem(hMenu, IDM_SHAPESTYLE_OUTLINE, IDM_SHAPESTYLE_FILLED, wParamLow, MF_BYCOMMAND);
+			bFillShapes = wParamLow == IDM_SHAPESTYLE_FILLED;
+		}	break;
 		case IDM_COLOR: {
 			static COLORREF custColors[16] = { penColor };
 			CHOOSECOLORW chooseColor = { sizeof(chooseColor) };
@@ -250,6 +464,16 @@ LRESULT CALLBACK WndProc_Main(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam
 			if (ChooseColorW(&chooseColor))
 				penColor = chooseColor.rgbResult;
 		}	break;
+		case IDM_FONT: {
+			LOGFONTW logFont = logFont_Text;
+			CHOOSEFONTW chooseFont = { sizeof(chooseFont) };
+			chooseFont.hwndOwner = hWnd;
+			chooseFont.lpLogFont = &logFont;
+			chooseFont.Flags = CF_SCREENFONTS | CF_SCALABLEONLY | CF_NOVERTFONTS | CF_INITTOLOGFONTSTRUCT;
+			if (ChooseFontW(&chooseFont))
+				SetTextFont(logFont);
+		}	break;
+		case IDM_DIAGNOSTICS: diagnostics.Show(hWnd); break;
 		case IDM_ABOUT: DialogBoxW(GetModuleHandle(NULL), MAKEINTRESOURCE(IDD_DIALOG_ABOUT), hWnd, DlgProc_About); break;
 		default: PostMessageW(GetDlgItem(hWnd_PaintView, ID_CANVAS), uMsg, wParam, lParam); break;
 		}
@@ -269,7 +493,19 @@ LRESULT CALLBACK WndProc_Main(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam
 			}
 		}
 	}	break;
+	case WM_TIMELAPSE_PROGRESS: diagnostics.Set(DiagnosticReadouts::TimeLapse, L"Time-Lapse: " + to_wstring(wParam) + L" / " + to_wstring(lParam) + L" frames"); break;
+	case WM_TIMELAPSE_DONE: {
+		size_t uFrameCount;
+		float fFramesPerSecond;
+		const DWORD dwError = timeLapseExporter.Finish(uFrameCount, fFramesPerSecond);
+		EnableMenuItem(hMenu, IDM_EXPORTTIMELAPSE, MF_ENABLED);
+		diagnostics.Set(DiagnosticReadouts::TimeLapse, L"Time-Lapse: " + to_wstring(uFrameCount) + L" frames at " + to_wstring((int)fFramesPerSecond) + L" fps");
+		if (dwError != ERROR_SUCCESS)
+			MessageBoxW(hWnd, (wstring(EXPORT_FAIL_PROMPT) + SysErrorMsg(dwError).GetMsg()).c_str(), NULL, MB_OK | MB_ICONERROR);
+	}	break;
 	case WM_DESTROY: {
+		timeLapseExporter.Cancel();
+		DeleteFont(hFont_History);
 		DeleteBrush(hBrush_Background);
 		PostQuitMessage(0);
 	}	break;
@@ -337,6 +573,12 @@ LRESULT CALLBACK WndProc_PaintView(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM l
 			scrollInfo.fMask = SIF_POS;
 			scrollInfo.nPos = currentScrollPos = pos;;
 			SetScrollInfo(hWnd, (uMsg == WM_HSCROLL ? SB_HORZ : SB_VERT), &scrollInfo, TRUE);
+			// Warm up the canvas one page beyond the viewport in every direction
+			RECT rect;
+			GetClientRect(hWnd, &rect);
+			OffsetRect(&rect, currentScroll.cx - Scale(CANVAS_LEFT, iDPI), currentScroll.cy - Scale(CANVAS_TOP, iDPI));
+			InflateRect(&rect, rect.right - rect.left, rect.bottom - rect.top);
+			renderer.Prefetch(rect);
 		}
 	}	break;
 	case WM_MOUSEWHEEL: {
@@ -361,39 +603,36 @@ LRESULT CALLBACK WndProc_PaintView(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM l
 }
 
 LRESULT CALLBACK WndProc_Canvas(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam) {
-	static const DWORD dwPixelSize = 3; // (BitmapInfo.bmiHeader.biBitCount = 24) / 8;
-	static BOOL bLeftButtonDown;
+	static BOOL bLeftButtonDown, bStartupTraced;
+	static float fPressure = 1;
 	static LONG lParentWindowStyle;
-	static DWORD dwScanLineSize, dwDIBSectionSize;
-	static PBYTE pDIBSection;
-	static auto_ptr<BYTE> previousDIBSection;
-	static HPEN hPen;
-	static HBITMAP hBitmap_Old;
+	static Shape shape;
+	static ShapeOverlay shapeOverlay;
 	static COORD mouseCoord;
-	static SIZE bitmapSize;
+	static SIZE bitmapSize; // size last reported by or submitted to the renderer
 	static RECT canvasRect, rightShadowRect, bottomShadowRect, gripRect;
 	switch (uMsg) {
 	case WM_CREATE: {
 		SetWindowPos(hWnd, NULL, 0, 0, 0, 0, SWP_NOSIZE | SWP_NOMOVE | SWP_FRAMECHANGED);
-		maxBitmapSize = { max(Scale(CANVAS_WIDTH,iDPI), GetSystemMetrics(SM_CXSCREEN)), max(Scale(CANVAS_HEIGHT,iDPI), GetSystemMetrics(SM_CYSCREEN)) };
-		BITMAPINFO bitmapInfo = { sizeof(bitmapInfo.bmiHeader) };
-		bitmapInfo.bmiHeader.biWidth = maxBitmapSize.cx;
-		bitmapInfo.bmiHeader.biHeight = -maxBitmapSize.cy;
-		bitmapInfo.bmiHeader.biPlanes = 1;
-		bitmapInfo.bmiHeader.biBitCount = 24;
-		dwScanLineSize = (dwPixelSize * maxBitmapSize.cx + 3) & ~3;
-		dwDIBSectionSize = maxBitmapSize.cy * dwScanLineSize;
+		// The canvas can outgrow RAM; without room for the largest one in the scratch file, it can still grow to the screen size
+		maxBitmapSize = { CANVAS_MAX_WIDTH, CANVAS_MAX_HEIGHT };
 		hDC_Canvas = GetDC(hWnd);
-		hDC_Memory = CreateCompatibleDC(NULL);
-		HBITMAP hBitmap = CreateDIBSection(NULL, &bitmapInfo, DIB_RGB_COLORS, (LPVOID*)&pDIBSection, NULL, 0);
-		if (hBitmap == NULL) {
+		RECT rect;
+		GetClientRect(hWnd, &rect);
+		bitmapSize = { rect.right, rect.bottom };
+		BOOL bStarted = renderer.Start(hWnd, maxBitmapSize, bitmapSize, uMemoryBudget);
+		if (!bStarted) {
+			renderer.Stop();
+			maxBitmapSize = { max(Scale(CANVAS_WIDTH, iDPI), GetSystemMetrics(SM_CXSCREEN)), max(Scale(CANVAS_HEIGHT, iDPI), GetSystemMetrics(SM_CYSCREEN)) };
+			bStarted = renderer.Start(hWnd, maxBitmapSize, bitmapSize, uMemoryBudget);
+		}
+		if (!bStarted) {
 			DWORD dwLastError = GetLastError();
 			MessageBoxW(hWnd, SysErrorMsg(dwLastError).GetMsg(), NULL, MB_OK | MB_ICONERROR);
 			PostQuitMessage(dwLastError);
 			break;
 		}
-		FillMemory(pDIBSection, dwDIBSectionSize, 0xff);
-		hBitmap_Old = SelectBitmap(hDC_Memory, hBitmap);
+		ClearHistory();
 	}	break;
 	case WM_NCCALCSIZE: {
 		if (wParam) {
@@ -417,13 +656,11 @@ LRESULT CALLBACK WndProc_Canvas(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lPar
 		return 0;
 	}
 	case WM_ENTERSIZEMOVE: {
+		EndText();
 		HWND hWnd_Parent = GetParent(hWnd);
 		lParentWindowStyle = GetWindowLongPtrW(hWnd_Parent, GWL_STYLE);
 		SetWindowLongPtrW(hWnd_Parent, GWL_STYLE, lParentWindowStyle & ~WS_CLIPCHILDREN);
 		canvasRect = { Scale(CANVAS_LEFT, iDPI), Scale(CANVAS_TOP, iDPI) };
-		bitmapSize = canvasSize;
-		previousDIBSection.reset(new BYTE[dwDIBSectionSize]);
-		CopyMemory(previousDIBSection.get(), pDIBSection, dwDIBSectionSize);
 	}	break;
 	case WM_SIZING: {
 		const PRECT pRect = (PRECT)lParam;
@@ -457,71 +694,66 @@ LRESULT CALLBACK WndProc_Canvas(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lPar
 	case WM_EXITSIZEMOVE: {
 		SetWindowLongPtrW(GetParent(hWnd), GWL_STYLE, lParentWindowStyle);
 		if (canvasSize.cx != bitmapSize.cx || canvasSize.cy != bitmapSize.cy) {
-			bFileSaved = FALSE;
 			SendMessageW(GetParent(hWnd), WM_SIZE, 0, 0);
-			PartialBitmap partialBitmap = { bitmapSize };
-			LPCBYTE pPreviousDIBSection = previousDIBSection.get();
-			if (canvasSize.cx < partialBitmap.Size.cx)
-				for (long x = canvasSize.cx; x < partialBitmap.Size.cx; x++)
-					for (long y = 0; y < canvasSize.cy; y++) {
-						const DWORD i = x * dwPixelSize + y * dwScanLineSize;
-						const RGBQUAD& rgbq = (RGBQUAD&)pPreviousDIBSection[i];
-						if (rgbq.rgbRed != 0xff || rgbq.rgbGreen != 0xff || rgbq.rgbGreen != 0xff)
-							partialBitmap.Pixels.push_back({ i, rgbq });
-					}
-			else if (canvasSize.cx > partialBitmap.Size.cx) {
-				RECT rect = { partialBitmap.Size.cx, 0, canvasSize.cx, partialBitmap.Size.cy };
-				FillRect(hDC_Memory, &rect, SYS_WHITE_BRUSH);
-			}
-			if (canvasSize.cy < partialBitmap.Size.cy)
-				for (long x = 0; x < partialBitmap.Size.cx; x++)
-					for (long y = canvasSize.cy; y < partialBitmap.Size.cy; y++) {
-						const DWORD i = x * dwPixelSize + y * dwScanLineSize;
-						const RGBQUAD& rgbq = (RGBQUAD&)pPreviousDIBSection[i];
-						if (rgbq.rgbRed != 0xff || rgbq.rgbGreen != 0xff || rgbq.rgbGreen != 0xff)
-							partialBitmap.Pixels.push_back({ i, rgbq });
-					}
-			else if (canvasSize.cy > partialBitmap.Size.cy) {
-				RECT rect = { 0, partialBitmap.Size.cy, canvasSize.cx, canvasSize.cy };
-				FillRect(hDC_Memory, &rect, SYS_WHITE_BRUSH);
-			}
-			undoHistory.push(partialBitmap);
-			redoHistory = decltype(redoHistory)();
-			previousDIBSection.reset(nullptr);
-			EnableMenuItem(hMenu, IDM_REDO, MF_DISABLED);
-			EnableMenuItem(hMenu, IDM_UNDO, MF_ENABLED);
+			RenderCommand command = { RenderCommandTypes::Resize, GetInputTime() };
+			command.Size = bitmapSize = canvasSize;
+			IssueCommand(command);
 		}
 	}	break;
 	case WM_LBUTTONDOWN: {
+		EndText();
 		bLeftButtonDown = TRUE;
 		SetCapture(hWnd);
 		if (paintingTool != PaintingTools::ColorPicker) {
 			mouseCoord = { GET_X_LPARAM(lParam), GET_Y_LPARAM(lParam) };
-			bitmapSize = canvasSize;
-			previousDIBSection.reset(new BYTE[dwDIBSectionSize]);
-			CopyMemory(previousDIBSection.get(), pDIBSection, dwDIBSectionSize);
+			RenderCommand command = { RenderCommandTypes::BeginStroke, GetInputTime() };
 			switch (paintingTool) {
 			case PaintingTools::Pen: case PaintingTools::Eraser: {
-				hPen = CreatePen(PS_SOLID,
-					paintingTool == PaintingTools::Pen ? iPenWidth : iEraserWidth,
-					paintingTool == PaintingTools::Pen ? penColor : 0xffffff);
-				SelectPen(hDC_Canvas, hPen);
-				SelectPen(hDC_Memory, hPen);
-				SetPixelV(hDC_Canvas, mouseCoord.X, mouseCoord.Y, paintingTool == PaintingTools::Pen ? penColor : 0xffffff);
-				SetPixelV(hDC_Memory, mouseCoord.X, mouseCoord.Y, paintingTool == PaintingTools::Pen ? penColor : 0xffffff);
-				MoveToEx(hDC_Canvas, mouseCoord.X, mouseCoord.Y, NULL);
-				MoveToEx(hDC_Memory, mouseCoord.X, mouseCoord.Y, NULL);
-				LineTo(hDC_Canvas, mouseCoord.X, mouseCoord.Y);
-				LineTo(hDC_Memory, mouseCoord.X, mouseCoord.Y);
+				if ((GetMessageExtraInfo() & MI_WP_SIGNATURE_MASK) != MI_WP_SIGNATURE)
+					fPressure = 1;
+				command.Color = paintingTool == PaintingTools::Pen ? penColor : 0xffffff;
+				command.bHardness = bBrushHardness;
+				command.fX = mouseCoord.X + 0.5f;
+				command.fY = mouseCoord.Y + 0.5f;
+				command.fPressure = fPressure;
+				command.fDiameter = (float)(paintingTool == PaintingTools::Pen ? iPenWidth : iEraserWidth);
+				command.fSpacing = fBrushSpacing;
+				IssueCommand(command);
 			}	break;
 			case PaintingTools::Fill: {
-				COLORREF color = GetPixel(hDC_Canvas, mouseCoord.X, mouseCoord.Y);
-				HBRUSH hBrush = CreateSolidBrush(penColor);
-				SelectBrush(hDC_Canvas, hBrush);
-				SelectBrush(hDC_Memory, hBrush);
-				ExtFloodFill(hDC_Canvas, mouseCoord.X, mouseCoord.Y, color, FLOODFILLSURFACE);
-				ExtFloodFill(hDC_Memory, mouseCoord.X, mouseCoord.Y, color, FLOODFILLSURFACE);
-				DeleteBrush(hBrush);
+				command.Type = RenderCommandTypes::Fill;
+				command.Color = penColor;
+				command.fX = mouseCoord.X;
+				command.fY = mouseCoord.Y;
+				IssueCommand(command);
+			}	break;
+			case PaintingTools::Line: case PaintingTools::Rectangle: case PaintingTools::Ellipse: {
+				shape.Type = paintingTool == PaintingTools::Line ? ShapeTypes::Line : paintingTool == PaintingTools::Rectangle ? ShapeTypes::Rectangle : ShapeTypes::Ellipse;
+				shape.From = shape.To = { mouseCoord.X, mouseCoord.Y };
+				shape.Color = penColor;
+				shape.iWidth = iPenWidth;
+				shape.bFilled = bFillShapes && paintingTool != PaintingTools::Line;
+				const RECT rect = { 0, 0, canvasSize.cx, canvasSize.cy };
+				shapeOverlay.Show(hDC_Canvas, CopyCanvas, rect, shape);
+			}	break;
+			case PaintingTools::Text: {
+				command.Type = RenderCommandTypes::BeginText;
+				command.Color = penColor;
+				command.fX = mouseCoord.X;
+				command.fY = mouseCoord.Y;
+				command.Font = textFont;
+				IssueCommand(command);
+				bTyping = TRUE;
+				textOrigin = { mouseCoord.X, mouseCoord.Y };
+				hFont_Text = CreateTextFont(textFont);
+				HFONT hFont_Old = SelectFont(hDC_Canvas, hFont_Text);
+				TEXTMETRICW textMetric;
+				GetTextMetricsW(hDC_Canvas, &textMetric);
+				SelectFont(hDC_Canvas, hFont_Old);
+				SetFocus(hWnd);
+				CreateCaret(hWnd, NULL, max(Scale(1, iDPI), 1), textMetric.tmHeight);
+				UpdateTextCaret();
+				ShowCaret(hWnd);
 			}	break;
 			}
 		}
@@ -535,40 +767,79 @@ LRESULT CALLBACK WndProc_Canvas(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lPar
 			mouseCoord = coord;
 			switch (paintingTool) {
 			case PaintingTools::Pen: case PaintingTools::Eraser: {
-				LineTo(hDC_Canvas, mouseCoord.X, mouseCoord.Y);
-				LineTo(hDC_Memory, mouseCoord.X, mouseCoord.Y);
+				RenderCommand command = { RenderCommandTypes::StrokeTo, GetInputTime() };
+				command.fX = mouseCoord.X + 0.5f;
+				command.fY = mouseCoord.Y + 0.5f;
+				command.fPressure = fPressure;
+				IssueCommand(command);
+			}	break;
+			case PaintingTools::Line: case PaintingTools::Rectangle: case PaintingTools::Ellipse: {
+				LARGE_INTEGER frequency, startTime, endTime;
+				QueryPerformanceFrequency(&frequency);
+				QueryPerformanceCounter(&startTime);
+				shape.To = { mouseCoord.X, mouseCoord.Y };
+				const RECT rect = { 0, 0, canvasSize.cx, canvasSize.cy };
+				shapeOverlay.Show(hDC_Canvas, CopyCanvas, rect, shape);
+				GdiFlush();
+				QueryPerformanceCounter(&endTime);
+				diagnostics.Set(DiagnosticReadouts::FrameTime, L"Preview Frame Time: " + to_wstring((endTime.QuadPart - startTime.QuadPart) * 1000000 / frequency.QuadPart) + L" \xb5s");
 			}	break;
 			}
 		}
 	}	break;
 	case WM_MOUSELEAVE: SendMessageW(hWnd_StatusBar, SB_SETTEXT, 0, 0); break;
+	case WM_POINTERDOWN: case WM_POINTERUPDATE: {
+		POINTER_INPUT_TYPE pointerType;
+		POINTER_PEN_INFO pointerPenInfo;
+		if (GetPointerType(GET_POINTERID_WPARAM(wParam), &pointerType) && pointerType == PT_PEN &&
+			GetPointerPenInfo(GET_POINTERID_WPARAM(wParam), &pointerPenInfo) && pointerPenInfo.penMask & PEN_MASK_PRESSURE)
+			fPressure = pointerPenInfo.pressure / MAX_POINTER_PRESSURE;
+		else
+			fPressure = 1;
+	}	break; // let DefWindowProcW generate the mouse messages
 	case WM_LBUTTONUP: ReleaseCapture(); break;
+	case WM_CHAR: {
+		WCHAR wc = (WCHAR)wParam;
+		if (!bTyping || IS_HIGH_SURROGATE(wc) || IS_LOW_SURROGATE(wc))
+			break;
+		if (wc == L'\r')
+			wc = L'\n';
+		if (wc == L'\b') {
+			if (typedText.empty())
+				break;
+			typedText.pop_back();
+		}
+		else if (wc == L'\n' || wc >= L' ')
+			typedText.push_back(wc);
+		else
+			break;
+		RenderCommand command = { RenderCommandTypes::TypeText, GetInputTime() };
+		command.wc = wc;
+		IssueCommand(command);
+		UpdateTextCaret();
+	}	break;
+	case WM_KILLFOCUS: EndText(); break;
 	case WM_CAPTURECHANGED: {
 		if (bLeftButtonDown) {
 			bLeftButtonDown = FALSE;
 			switch (paintingTool) {
-			case PaintingTools::Pen: case PaintingTools::Eraser: DeletePen(hPen); // no "break;"
-			case PaintingTools::Fill: {
-				bFileSaved = FALSE;
-				PartialBitmap partialBitmap = { bitmapSize };
-				LPCBYTE pPreviousDIBSection = previousDIBSection.get();
-				for (long x = 0; x < partialBitmap.Size.cx; x++)
-					for (long y = 0; y < partialBitmap.Size.cy; y++) {
-						const DWORD i = x * dwPixelSize + y * dwScanLineSize;
-						const RGBQUAD& rgbq = (RGBQUAD&)pDIBSection[i], & previousColor = (RGBQUAD&)pPreviousDIBSection[i];
-						if (rgbq.rgbRed != previousColor.rgbRed || rgbq.rgbGreen != previousColor.rgbGreen || rgbq.rgbBlue != previousColor.rgbBlue)
-							partialBitmap.Pixels.push_back({ i, previousColor });
-					}
-				undoHistory.push(partialBitmap);
-				redoHistory = decltype(redoHistory)();
-				previousDIBSection.reset(nullptr);
-				EnableMenuItem(hMenu, IDM_REDO, MF_DISABLED);
-				EnableMenuItem(hMenu, IDM_UNDO, MF_ENABLED);
+			case PaintingTools::Pen: case PaintingTools::Eraser: case PaintingTools::Fill:
+			case PaintingTools::Line: case PaintingTools::Rectangle: case PaintingTools::Ellipse: {
+				RenderCommand command = { RenderCommandTypes::Commit, GetInputTime(), GetPaintingToolName(paintingTool) };
+				switch (paintingTool) {
+				case PaintingTools::Line: case PaintingTools::Rectangle: case PaintingTools::Ellipse: {
+					command.Type = RenderCommandTypes::DrawShape;
+					command.DrawnShape = shape;
+					shapeOverlay.Release();
+				}	break;
+				}
+				IssueCommand(command);
 			}	break;
 			case PaintingTools::ColorPicker: {
 				penColor = GetPixel(hDC_Canvas, LOWORD(lParam), HIWORD(lParam));
 				switch (previousPaintingTool) {
-				case PaintingTools::Pen: case PaintingTools::Eraser: paintingTool = previousPaintingTool; break;
+				case PaintingTools::Pen: case PaintingTools::Eraser:
+				case PaintingTools::Line: case PaintingTools::Rectangle: case PaintingTools::Ellipse: case PaintingTools::Text: paintingTool = previousPaintingTool; break;
 				}
 				CheckMenuRadioItem(hMenu, IDM_PEN, IDM_COLORPICKER, (UINT)paintingTool, MF_BYCOMMAND);
 			}	break;
@@ -578,88 +849,115 @@ LRESULT CALLBACK WndProc_Canvas(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lPar
 	case WM_COMMAND: {
 		const WORD wParamLow = LOWORD(wParam);
 		switch (wParamLow) {
-		case IDA_UNDO: {
-			if (!bLeftButtonDown && !undoHistory.empty()) {
-				bFileSaved = FALSE;
-				const auto& partialBitmap = undoHistory.top();
-				if (canvasSize.cx < partialBitmap.Size.cx) {
-					RECT rect = { canvasSize.cx, 0, partialBitmap.Size.cx, canvasSize.cy };
-					FillRect(hDC_Memory, &rect, SYS_WHITE_BRUSH);
-				}
-				if (canvasSize.cy < partialBitmap.Size.cy) {
-					RECT rect = { 0, canvasSize.cy, partialBitmap.Size.cx, partialBitmap.Size.cy };
-					FillRect(hDC_Memory, &rect, SYS_WHITE_BRUSH);
-				}
-				vector<PIXEL> temp;
-				for (const auto& pixel : partialBitmap.Pixels) {
-					const DWORD i = pixel.dwDIBSectionIndex;
-					RGBQUAD& rgbq = (RGBQUAD&)pDIBSection[i];
-					temp.push_back({ i, { rgbq.rgbBlue, rgbq.rgbGreen, rgbq.rgbRed } });
-					rgbq.rgbRed = pixel.Rgbq.rgbRed;
-					rgbq.rgbGreen = pixel.Rgbq.rgbGreen;
-					rgbq.rgbBlue = pixel.Rgbq.rgbBlue;
-				}
-				redoHistory.push({ canvasSize, temp });
-				if (canvasSize.cx != partialBitmap.Size.cx || canvasSize.cy != partialBitmap.Size.cy) {
-					SetWindowPos(hWnd, NULL, 0, 0, partialBitmap.Size.cx + iActualMargin, partialBitmap.Size.cy + iActualMargin, SWP_NOMOVE | SWP_NOZORDER);
-					SendMessageW(GetParent(hWnd), WM_SIZE, 0, 0);
-				}
-				undoHistory.pop();
-				EnableMenuItem(hMenu, IDM_REDO, MF_ENABLED);
-				if (undoHistory.empty())
-					EnableMenuItem(hMenu, IDM_UNDO, MF_DISABLED);
-				BitBlt(hDC_Canvas, 0, 0, canvasSize.cx, canvasSize.cy, hDC_Memory, 0, 0, SRCCOPY);
+		case IDA_UNDO: case IDA_REDO: case ID_HISTORY: {
+			if (wParamLow == ID_HISTORY && HIWORD(wParam) != LBN_SELCHANGE)
+				break;
+			EndText();
+			replica.WaitForEchoes();
+			size_t uTarget = uHistoryPosition;
+			switch (wParamLow) {
+			case IDA_UNDO: if (uHistoryPosition) uTarget--; break;
+			case IDA_REDO: if (uHistoryPosition < uHistoryCount) uTarget++; break;
+			case ID_HISTORY: uTarget = (size_t)max(SendMessageW(hWnd_History, LB_GETCURSEL, 0, 0), 0); break;
 			}
-		}	break;
-		case IDA_REDO: {
-			if (!bLeftButtonDown && !redoHistory.empty()) {
-				bFileSaved = FALSE;
-				const auto& partialBitmap = redoHistory.top();
-				if (canvasSize.cx < partialBitmap.Size.cx) {
-					RECT rect = { canvasSize.cx, 0, partialBitmap.Size.cx, canvasSize.cy };
-					FillRect(hDC_Memory, &rect, SYS_WHITE_BRUSH);
-				}
-				if (canvasSize.cy < partialBitmap.Size.cy) {
-					RECT rect = { 0, canvasSize.cy, partialBitmap.Size.cx, partialBitmap.Size.cy };
-					FillRect(hDC_Memory, &rect, SYS_WHITE_BRUSH);
-				}
-				vector<PIXEL> temp;
-				for (const auto& pixel : partialBitmap.Pixels) {
-					const DWORD i = pixel.dwDIBSectionIndex;
-					RGBQUAD& rgbq = (RGBQUAD&)pDIBSection[i];
-					temp.push_back({ i, { rgbq.rgbBlue, rgbq.rgbGreen, rgbq.rgbRed } });
-					rgbq.rgbRed = pixel.Rgbq.rgbRed;
-					rgbq.rgbGreen = pixel.Rgbq.rgbGreen;
-					rgbq.rgbBlue = pixel.Rgbq.rgbBlue;
-				}
-				undoHistory.push({ canvasSize, temp });
-				if (canvasSize.cx != partialBitmap.Size.cx || canvasSize.cy != partialBitmap.Size.cy) {
-					SetWindowPos(hWnd, NULL, 0, 0, partialBitmap.Size.cx + iActualMargin, partialBitmap.Size.cy + iActualMargin, SWP_NOMOVE | SWP_NOZORDER);
-					SendMessageW(GetParent(hWnd), WM_SIZE, 0, 0);
-				}
-				redoHistory.pop();
-				EnableMenuItem(hMenu, IDM_UNDO, MF_ENABLED);
-				if (redoHistory.empty())
-					EnableMenuItem(hMenu, IDM_REDO, MF_DISABLED);
-				BitBlt(hDC_Canvas, 0, 0, canvasSize.cx, canvasSize.cy, hDC_Memory, 0, 0, SRCCOPY);
+			if (!bLeftButtonDown && uTarget != uHistoryPosition) {
+				RenderCommand command = { RenderCommandTypes::Jump, GetInputTime() };
+				command.uTarget = uTarget;
+				command.uBaseVersion = uHistoryVersion;
+				IssueCommand(command);
 			}
+			UpdateHistoryState();
 		}	break;
 		case IDA_CANCEL: {
+			if (bTyping) {
+				typedText.clear();
+				EndText();
+			}
 			if (bLeftButtonDown) {
 				bLeftButtonDown = FALSE;
 				ReleaseCapture();
 				switch (paintingTool) {
-				case PaintingTools::Pen: case PaintingTools::Eraser: DeletePen(hPen); // no "break;"
-				case PaintingTools::Fill: {
-					CopyMemory(pDIBSection, previousDIBSection.get(), dwDIBSectionSize);
-					previousDIBSection.reset(nullptr);
-					BitBlt(hDC_Canvas, 0, 0, canvasSize.cx, canvasSize.cy, hDC_Memory, 0, 0, SRCCOPY);
+				case PaintingTools::Pen: case PaintingTools::Eraser: case PaintingTools::Fill: {
+					const RenderCommand command = { RenderCommandTypes::Cancel, GetInputTime() };
+					IssueCommand(command);
 				}	break;
+				case PaintingTools::Line: case PaintingTools::Rectangle: case PaintingTools::Ellipse: shapeOverlay.Hide(hDC_Canvas, CopyCanvas); break;
 				}
 			}
 		}	break;
+		case IDM_SHAREDCANVAS: {
+			EndText();
+			if (replica.IsJoined()) {
+				replica.Leave();
+				CheckMenuItem(hMenu, IDM_SHAREDCANVAS, MF_UNCHECKED);
+				diagnostics.Set(DiagnosticReadouts::SharedCanvas, L"");
+				break;
+			}
+			if (bLeftButtonDown)
+				break;
+			renderer.Flush();
+			if (replica.Join(hWnd, renderer, renderer.GetOpLog(), ApplyCommand)) {
+				CheckMenuItem(hMenu, IDM_SHAREDCANVAS, MF_CHECKED);
+				diagnostics.Set(DiagnosticReadouts::SharedCanvas, L"Shared Canvas: Joined");
+			}
+			else
+				MessageBoxW(hWnd, (wstring(SYNC_FAIL_PROMPT) + SysErrorMsg(GetLastError()).GetMsg()).c_str(), NULL, MB_OK | MB_ICONERROR);
+		}	break;
+		}
+	}	break;
+	case WM_SYNC_RECEIVE: {
+		replica.Receive();
+		float fOpsPerSecond;
+		ULONGLONG ullRoundTripMicroseconds;
+		if (replica.GetStatistics(fOpsPerSecond, ullRoundTripMicroseconds))
+			diagnostics.Set(DiagnosticReadouts::SharedCanvas, L"Shared Canvas: " + to_wstring((int)fOpsPerSecond) + L" ops/s, " + to_wstring(ullRoundTripMicroseconds) + L" \xb5s round trip");
+	}	break;
+	case WM_SYNC_DISCONNECTED: {
+		// Posted by a session that has been left already
+		if ((UINT)lParam != replica.GetSession())
+			break;
+		replica.Leave();
+		CheckMenuItem(hMenu, IDM_SHAREDCANVAS, MF_UNCHECKED);
+		diagnostics.Set(DiagnosticReadouts::SharedCanvas, L"Shared Canvas: Disconnected (Error " + to_wstring(wParam) + L")");
+	}	break;
+	case WM_RENDER_PRESENT: {
+		RECT rect;
+		SIZE size;
+		LONGLONG llInputTime, llJumpTime;
+		if (!renderer.PopPresentItems(rect, size, llInputTime, llJumpTime))
+			break;
+		if (size.cx != bitmapSize.cx || size.cy != bitmapSize.cy) {
+			bitmapSize = size;
+			SetWindowPos(hWnd, NULL, 0, 0, size.cx + iActualMargin, size.cy + iActualMargin, SWP_NOMOVE | SWP_NOZORDER);
+			SendMessageW(GetParent(hWnd), WM_SIZE, 0, 0);
+		}
+		HideCaret(hWnd);
+		renderer.Copy(hDC_Canvas, rect.left, rect.top, rect);
+		ShowCaret(hWnd);
+		if (bLeftButtonDown)
+			switch (paintingTool) {
+			case PaintingTools::Line: case PaintingTools::Rectangle: case PaintingTools::Ellipse: {
+				const RECT bitmapRect = { 0, 0, canvasSize.cx, canvasSize.cy };
+				shapeOverlay.Show(hDC_Canvas, CopyCanvas, bitmapRect, shape);
+			}	break;
+			}
+		if (paintingTool == PaintingTools::Text) {
+			const TextStatistics textStatistics = renderer.GetTextStatistics();
+			diagnostics.Set(DiagnosticReadouts::Glyphs, L"Glyphs: " + to_wstring(textStatistics.Atlas.ullMisses * 1000000 / max(textStatistics.Atlas.ullMissMicroseconds, 1ULL)) + L"/s cold, " + to_wstring(textStatistics.ullGlyphsDrawn * 1000000 / max(textStatistics.ullDrawMicroseconds, 1ULL)) + L"/s warm; Atlas: " + to_wstring(textStatistics.Atlas.ullHits) + L" hits, " + to_wstring(textStatistics.Atlas.ullMisses) + L" misses");
+		}
+		CacheStatistics canvasStatistics, historyStatistics;
+		renderer.GetStatistics(canvasStatistics, historyStatistics);
+		diagnostics.Set(DiagnosticReadouts::Cache, L"Canvas Cache: " + to_wstring(canvasStatistics.ullHits) + L" hits, " + to_wstring(canvasStatistics.ullMisses) + L" misses (" + to_wstring(canvasStatistics.ullMissMicroseconds / max(canvasStatistics.ullMisses, 1ULL)) + L" \xb5s each)"
+			L"; History Cache: " + to_wstring(historyStatistics.ullHits) + L" hits, " + to_wstring(historyStatistics.ullMisses) + L" misses (" + to_wstring(historyStatistics.ullMissMicroseconds / max(historyStatistics.ullMisses, 1ULL)) + L" \xb5s each)");
+		// Set last, so the status bar shows the latency while painting
+		if (llInputTime) {
+			LARGE_INTEGER frequency;
+			QueryPerformanceFrequency(&frequency);
+			diagnostics.Set(DiagnosticReadouts::Latency, L"Input-to-Present Latency: " + to_wstring((GetInputTime() - llInputTime) * 1000000 / frequency.QuadPart) + L" \xb5s"
+				+ (llJumpTime ? L", History Jump Time: " + to_wstring(llJumpTime * 1000000 / frequency.QuadPart) + L" \xb5s" : L""));
 		}
 	}	break;
+	case WM_RENDER_ERROR: MessageBoxW(hWnd, (wstring(HISTORY_FAIL_PROMPT) + SysErrorMsg((DWORD)wParam).GetMsg()).c_str(), NULL, MB_OK | MB_ICONERROR); break;
 	case WM_NCPAINT: {
 		HDC hDC = GetWindowDC(hWnd);
 		TRIVERTEX triVertices[] = {
@@ -680,12 +978,16 @@ LRESULT CALLBACK WndProc_Canvas(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lPar
 	case WM_PAINT: {
 		PAINTSTRUCT ps;
 		HDC hDC = BeginPaint(hWnd, &ps);
-		BitBlt(hDC_Canvas, 0, 0, canvasSize.cx, canvasSize.cy, hDC_Memory, 0, 0, SRCCOPY);
+		renderer.Copy(hDC, ps.rcPaint.left, ps.rcPaint.top, ps.rcPaint);
 		EndPaint(hWnd, &ps);
+		if (!bStartupTraced) {
+			bStartupTraced = TRUE;
+			diagnostics.Set(DiagnosticReadouts::Startup, L"Startup Time: " + to_wstring(GetProcessUptime()) + L" ms, Working Set: " + to_wstring(GetWorkingSetSize() >> 10) + L" KB");
+		}
 	}	break;
 	case WM_DESTROY: {
-		DeleteBitmap(SelectBitmap(hDC_Memory, hBitmap_Old));
-		DeleteDC(hDC_Memory);
+		replica.Leave();
+		renderer.Stop();
 		ReleaseDC(hWnd, hDC_Canvas);
 	}	break;
 	}
@@ -0,0 +1,362 @@
+#pragma once
+
+#include <Windows.h>
+#include <climits>
+#include <cmath>
+#include <cwchar>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+#include "ShapeOverlay.h"
+#include "Text.h"
+
+#define OP_LOG_MAX_IDLE_TIME 1000 // milliseconds; longer pauses are shortened so that replays do not stall
+#define OP_LOG_COORDINATE_SCALE 16.0f // fixed point for coordinates and diameters, exact for the half pixels strokes use
+#define OP_LOG_PRESSURE_SCALE 1024.0f // exact for pointer pressures, which come in 1/1024 steps
+#define OP_LOG_SPACING_SCALE 100.0f
+
+enum class RenderCommandTypes { BeginStroke, StrokeTo, Fill, Commit, Cancel, DrawShape, Resize, Jump, Clear, Barrier, Quit, BeginText, TypeText };
+
+// Flat so that it can be copied through the command queue; only the members used by Type are meaningful
+struct RenderCommand {
+	RenderCommandTypes Type;
+	LONGLONG llInputTime; // QueryPerformanceCounter value of the input that caused the command
+	LPCWSTR lpcwName; // Commit, DrawShape: history entry name, must be a string literal
+	COLORREF Color; // BeginStroke, Fill, BeginText
+	BYTE bHardness; // BeginStroke
+	float fX, fY, fPressure; // BeginStroke, StrokeTo; Fill uses (fX, fY) as the seed point, BeginText as the top left of the text
+	float fDiameter, fSpacing; // BeginStroke
+	Shape DrawnShape; // DrawShape
+	TextFont Font; // BeginText
+	WCHAR wc; // TypeText: character to append, '\n' for a line break or '\b' to remove the last character
+	SIZE Size; // Resize, Clear
+	size_t uTarget; // Jump
+	size_t uBaseVersion; // Jump: history version the target was chosen at, which a shared canvas checks before it applies the jump
+	HANDLE hEvent; // Barrier: signaled once every preceding command has been rendered
+};
+
+// Compact binary record of the render commands of one canvas, each stamped with its time since the first one.
+// Every command is a type byte and a varint time delta followed only by the fields its type uses; coordinates are
+// fixed point and stroke points are stored as deltas, so a stroke segment usually takes 5 to 7 bytes.
+// A history entry name or font face is written out in full the first time it is used and as an index after that, so logs can be read
+// by other processes.
+class OpLog {
+private:
+	std::vector<BYTE> bytes;
+	std::vector<LPCWSTR> names;
+	ULONGLONG ullTime = 0, ullLastTime = 0; // ullLastTime is the absolute time of the last command
+	LONG lLastX = 0, lLastY = 0;
+
+	void WriteUnsigned(ULONGLONG ullValue) {
+		for (; ullValue >= 0x80; ullValue >>= 7)
+			bytes.push_back((BYTE)(ullValue | 0x80));
+		bytes.push_back((BYTE)ullValue);
+	}
+
+	void WriteSigned(LONGLONG llValue) { WriteUnsigned(((ULONGLONG)llValue << 1) ^ (ULONGLONG)(llValue >> 63)); }
+
+	void WriteColor(COLORREF color) {
+		bytes.push_back(GetRValue(color));
+		bytes.push_back(GetGValue(color));
+		bytes.push_back(GetBValue(color));
+	}
+
+	void WritePoint(float fX, float fY) {
+		const LONG lX = (LONG)lroundf(fX * OP_LOG_COORDINATE_SCALE), lY = (LONG)lroundf(fY * OP_LOG_COORDINATE_SCALE);
+		WriteSigned(lX - lLastX);
+		WriteSigned(lY - lLastY);
+		lLastX = lX;
+		lLastY = lY;
+	}
+
+	void WriteName(LPCWSTR lpcwName) {
+		size_t i = 0;
+		while (i < names.size() && names[i] != lpcwName)
+			i++;
+		WriteUnsigned(i);
+		if (i == names.size()) {
+			names.push_back(lpcwName);
+			const size_t uLength = wcslen(lpcwName);
+			WriteUnsigned(uLength);
+			for (size_t j = 0; j < uLength; j++)
+				WriteUnsigned(lpcwName[j]);
+		}
+	}
+
+public:
+	// Reads commands back in order; the log must outlive the reader. Logs from other processes are not trusted: every read
+	// is bounded, and a command that runs past the end of the log or holds anything Record cannot have written ends the
+	// log as malformed.
+	class Reader {
+	private:
+		const OpLog& opLog;
+		size_t uOffset = 0;
+		ULONGLONG ullTime = 0;
+		LONG lLastX = 0, lLastY = 0;
+		std::vector<LPCWSTR> names;
+		BOOL bMalformed = FALSE;
+
+		BYTE ReadByte() {
+			if (uOffset < opLog.bytes.size())
+				return opLog.bytes[uOffset++];
+			bMalformed = TRUE;
+			return 0;
+		}
+
+		ULONGLONG ReadUnsigned() {
+			ULONGLONG ullValue = 0;
+			for (int iShift = 0; iShift < 64 && !bMalformed; iShift += 7) {
+				const BYTE b = ReadByte();
+				ullValue |= (ULONGLONG)(b & 0x7f) << iShift;
+				if (!(b & 0x80))
+					return ullValue;
+			}
+			bMalformed = TRUE;
+			return 0;
+		}
+
+		LONGLONG ReadSigned() {
+			const ULONGLONG ullValue = ReadUnsigned();
+			return (LONGLONG)(ullValue >> 1) ^ -(LONGLONG)(ullValue & 1);
+		}
+
+		COLORREF ReadColor() {
+			const BYTE bRed = ReadByte(), bGreen = ReadByte(), bBlue = ReadByte();
+			return RGB(bRed, bGreen, bBlue);
+		}
+
+		void ReadPoint(float& fX, float& fY) {
+			lLastX += ReadLong();
+			lLastY += ReadLong();
+			fX = lLastX / OP_LOG_COORDINATE_SCALE;
+			fY = lLastY / OP_LOG_COORDINATE_SCALE;
+		}
+
+		LONG ReadLong() {
+			const LONGLONG llValue = ReadSigned();
+			if (llValue < LONG_MIN || llValue > LONG_MAX)
+				bMalformed = TRUE;
+			return (LONG)llValue;
+		}
+
+		LONG ReadUnsignedLong() {
+			const ULONGLONG ullValue = ReadUnsigned();
+			if (ullValue > LONG_MAX)
+				bMalformed = TRUE;
+			return (LONG)ullValue;
+		}
+
+		// Every character takes at least a byte, so a name longer than the rest of the log is malformed before it is allocated
+		LPCWSTR ReadName() {
+			const ULONGLONG i = ReadUnsigned();
+			if (i == names.size()) {
+				const ULONGLONG ullLength = ReadUnsigned();
+				if (ullLength > opLog.bytes.size() - uOffset) {
+					bMalformed = TRUE;
+					return L"";
+				}
+				std::wstring name((size_t)ullLength, L'\0');
+				for (WCHAR& c : name) {
+					const ULONGLONG ullChar = ReadUnsigned();
+					if (ullChar > WCHAR_MAX)
+						bMalformed = TRUE;
+					c = (WCHAR)ullChar;
+				}
+				if (bMalformed)
+					return L"";
+				names.push_back(Intern(name));
+			}
+			else if (i > names.size()) {
+				bMalformed = TRUE;
+				return L"";
+			}
+			return names[(size_t)i];
+		}
+
+	public:
+		Reader(const OpLog& opLog) : opLog(opLog) {}
+
+		// Time in milliseconds of the command that the next call to Read returns
+		ULONGLONG PeekTime() {
+			const size_t uStartOffset = uOffset;
+			const BOOL bStartMalformed = bMalformed;
+			uOffset++;
+			const ULONGLONG ullNextTime = ullTime + ReadUnsigned();
+			uOffset = uStartOffset;
+			bMalformed = bStartMalformed;
+			return ullNextTime;
+		}
+
+		BOOL IsAtEnd() const { return uOffset >= opLog.bytes.size(); }
+
+		// TRUE once Read has met a command that is cut off or could not have been recorded
+		BOOL IsMalformed() const { return bMalformed; }
+
+		// Returns FALSE at the end of the log, or if the next command is malformed, after which the reader stays at the end;
+		// commands come back with llInputTime set to 0
+		BOOL Read(RenderCommand& command) {
+			if (IsAtEnd())
+				return FALSE;
+			command = { (RenderCommandTypes)ReadByte() };
+			ullTime += ReadUnsigned();
+			switch (command.Type) {
+			case RenderCommandTypes::BeginStroke: {
+				command.Color = ReadColor();
+				command.bHardness = ReadByte();
+				command.fDiameter = ReadUnsigned() / OP_LOG_COORDINATE_SCALE;
+				command.fSpacing = ReadByte() / OP_LOG_SPACING_SCALE;
+				ReadPoint(command.fX, command.fY);
+				command.fPressure = ReadUnsigned() / OP_LOG_PRESSURE_SCALE;
+			}	break;
+			case RenderCommandTypes::StrokeTo: {
+				ReadPoint(command.fX, command.fY);
+				command.fPressure = ReadUnsigned() / OP_LOG_PRESSURE_SCALE;
+			}	break;
+			case RenderCommandTypes::Fill: {
+				command.Color = ReadColor();
+				ReadPoint(command.fX, command.fY);
+			}	break;
+			case RenderCommandTypes::Commit: command.lpcwName = ReadName(); break;
+			case RenderCommandTypes::Cancel: break;
+			case RenderCommandTypes::DrawShape: {
+				command.lpcwName = ReadName();
+				const BYTE bShapeType = ReadByte();
+				if (bShapeType > (BYTE)ShapeTypes::Ellipse)
+					bMalformed = TRUE;
+				command.DrawnShape.Type = (ShapeTypes)bShapeType;
+				command.DrawnShape.From.x = ReadLong();
+				command.DrawnShape.From.y = ReadLong();
+				command.DrawnShape.To.x = ReadLong();
+				command.DrawnShape.To.y = ReadLong();
+				command.DrawnShape.Color = ReadColor();
+				command.DrawnShape.iWidth = (int)ReadUnsignedLong();
+				command.DrawnShape.bFilled = ReadByte();
+			}	break;
+			case RenderCommandTypes::Resize: case RenderCommandTypes::Clear: {
+				command.Size.cx = ReadUnsignedLong();
+				command.Size.cy = ReadUnsignedLong();
+			}	break;
+			case RenderCommandTypes::Jump: {
+				command.uTarget = (size_t)ReadUnsigned();
+				command.uBaseVersion = (size_t)ReadUnsigned();
+			}	break;
+			case RenderCommandTypes::BeginText: {
+				command.Color = ReadColor();
+				ReadPoint(command.fX, command.fY);
+				command.Font.lpcwFace = ReadName();
+				command.Font.lHeight = ReadUnsignedLong();
+				command.Font.lWeight = ReadUnsignedLong();
+				command.Font.bItalic = ReadByte();
+			}	break;
+			case RenderCommandTypes::TypeText: {
+				const ULONGLONG ullChar = ReadUnsigned();
+				if (ullChar > WCHAR_MAX)
+					bMalformed = TRUE;
+				command.wc = (WCHAR)ullChar;
+			}	break;
+			default: bMalformed = TRUE; break; // Barrier and Quit are never recorded
+			}
+			if (bMalformed) {
+				uOffset = opLog.bytes.size();
+				return FALSE;
+			}
+			return TRUE;
+		}
+	};
+
+	// History entries and fonts keep name pointers, so every name read lives as long as the process
+	static LPCWSTR Intern(const std::wstring& name) {
+		static std::mutex mutex;
+		static std::set<std::wstring> internedNames;
+		std::lock_guard<std::mutex> lock(mutex);
+		return internedNames.insert(name).first->c_str();
+	}
+
+	OpLog() = default;
+
+	// Wraps bytes written by another log, for reading only
+	explicit OpLog(const std::vector<BYTE>& bytes) : bytes(bytes) {}
+
+	// ullTime is in milliseconds on any monotonic clock. A Clear starts the log over, so a log that has seen one begins with it.
+	// Barriers and Quit are not recorded.
+	void Record(const RenderCommand& command, ULONGLONG ullTime) {
+		switch (command.Type) {
+		case RenderCommandTypes::Barrier: case RenderCommandTypes::Quit: return;
+		case RenderCommandTypes::Clear: {
+			bytes.clear();
+			names.clear();
+			this->ullTime = 0;
+			lLastX = lLastY = 0;
+		}	break;
+		}
+		const ULONGLONG ullDelta = bytes.empty() ? 0 : min(ullTime > ullLastTime ? ullTime - ullLastTime : 0, (ULONGLONG)OP_LOG_MAX_IDLE_TIME);
+		this->ullTime += ullDelta;
+		ullLastTime = ullTime;
+		bytes.push_back((BYTE)command.Type);
+		WriteUnsigned(ullDelta);
+		switch (command.Type) {
+		case RenderCommandTypes::BeginStroke: {
+			WriteColor(command.Color);
+			bytes.push_back(command.bHardness);
+			WriteUnsigned((ULONGLONG)lroundf(command.fDiameter * OP_LOG_COORDINATE_SCALE));
+			bytes.push_back((BYTE)lroundf(command.fSpacing * OP_LOG_SPACING_SCALE));
+			WritePoint(command.fX, command.fY);
+			WriteUnsigned((ULONGLONG)lroundf(command.fPressure * OP_LOG_PRESSURE_SCALE));
+		}	break;
+		case RenderCommandTypes::StrokeTo: {
+			WritePoint(command.fX, command.fY);
+			WriteUnsigned((ULONGLONG)lroundf(command.fPressure * OP_LOG_PRESSURE_SCALE));
+		}	break;
+		case RenderCommandTypes::Fill: {
+			WriteColor(command.Color);
+			WritePoint(command.fX, command.fY);
+		}	break;
+		case RenderCommandTypes::Commit: WriteName(command.lpcwName); break;
+		case RenderCommandTypes::DrawShape: {
+			const Shape& shape = command.DrawnShape;
+			WriteName(command.lpcwName);
+			bytes.push_back((BYTE)shape.Type);
+			WriteSigned(shape.From.x);
+			WriteSigned(shape.From.y);
+			WriteSigned(shape.To.x);
+			WriteSigned(shape.To.y);
+			WriteColor(shape.Color);
+			WriteUnsigned(shape.iWidth);
+			bytes.push_back((BYTE)shape.bFilled);
+		}	break;
+		case RenderCommandTypes::Resize: case RenderCommandTypes::Clear: {
+			WriteUnsigned(command.Size.cx);
+			WriteUnsigned(command.Size.cy);
+		}	break;
+		case RenderCommandTypes::Jump: {
+			WriteUnsigned(command.uTarget);
+			WriteUnsigned(command.uBaseVersion);
+		}	break;
+		case RenderCommandTypes::BeginText: {
+			WriteColor(command.Color);
+			WritePoint(command.fX, command.fY);
+			WriteName(command.Font.lpcwFace);
+			WriteUnsigned(command.Font.lHeight);
+			WriteUnsigned(command.Font.lWeight);
+			bytes.push_back((BYTE)command.Font.bItalic);
+		}	break;
+		case RenderCommandTypes::TypeText: WriteUnsigned(command.wc); break;
+		}
+	}
+
+	// Milliseconds from the first command to the last, with idle time shortened
+	ULONGLONG GetDuration() const { return ullTime; }
+
+	SIZE_T GetSize() const { return bytes.size(); }
+
+	const std::vector<BYTE>& GetBytes() const { return bytes; }
+
+	// Reads the whole log; FALSE if it is malformed, as logs received from other processes can be
+	BOOL IsWellFormed() const {
+		Reader reader(*this);
+		RenderCommand command;
+		while (reader.Read(command));
+		return !reader.IsMalformed();
+	}
+};
\ No newline at end of file
@@ -0,0 +1,469 @@
+#pragma once
+
+#include <Windows.h>
+#include <windowsx.h>
+#include <atomic>
+#include <memory>
+#include "BrushEngine.h"
+#include "History.h"
+#include "LazyBitmap.h"
+#include "OpLog.h"
+#include "ShapeOverlay.h"
+#include "SpillCache.h"
+#include "SPSCQueue.h"
+#include "Text.h"
+
+#define WM_RENDER_PRESENT (WM_APP + 1)
+#define WM_RENDER_ERROR (WM_APP + 6) // wParam: error code
+#define RENDER_COMMAND_QUEUE_SIZE 4096
+#define RENDER_PRESENT_QUEUE_SIZE 64
+#define RENDER_PRESENT_RETRY_INTERVAL 1
+
+struct PresentItem {
+	RECT DamageRect;
+	SIZE BitmapSize;
+	LONGLONG llInputTime;
+	LONGLONG llJumpTime; // QueryPerformanceCounter ticks spent on the last history jump, 0 if there was none
+};
+
+// Owns the canvas bitmap and its history. All pixel work happens on a dedicated thread fed through a lock-free queue;
+// the UI thread only copies damaged rectangles from a second DIB section that views the same memory.
+class Renderer {
+private:
+	static const DWORD dwPixelSize = 3;
+
+	HWND hWnd_Notify;
+	HANDLE hFile = INVALID_HANDLE_VALUE, hSection = NULL, hThread = NULL, hEvent_Command = NULL, hEvent_Barrier = NULL;
+	HDC hDC_Render = NULL, hDC_Present = NULL;
+	HBITMAP hBitmap_RenderOld = NULL, hBitmap_PresentOld = NULL;
+	PBYTE pBits = NULL;
+	DWORD dwScanLineSize, dwDIBSectionSize;
+	LONGLONG llFrequency, llLastJumpTime;
+	DWORD dwError = ERROR_SUCCESS; // of the last command that failed, until it is popped
+	SIZE maxSize, bitmapSize;
+	RECT pendingRect; // damage of the stroke, fill, shape or text being drawn
+	float fStrokeY, fStrokeRadius; // last stroke row and largest dab radius, used to commit rows ahead of the brush
+	LazyBitmap bitmap;
+	BrushEngine brushEngine;
+	TextEngine textEngine;
+	History history;
+	OpLog opLog; // written by the render thread only
+	SPSCQueue<RenderCommand, RENDER_COMMAND_QUEUE_SIZE> commandQueue;
+	SPSCQueue<PresentItem, RENDER_PRESENT_QUEUE_SIZE> presentQueue;
+	std::atomic<bool> bPresentPosted { false };
+
+	RECT GetBitmapRect() const { return { 0, 0, bitmapSize.cx, bitmapSize.cy }; }
+
+	// Sizes can come from other processes, so they are kept within the canvas memory
+	SIZE ClampSize(SIZE size) const { return { min(max(size.cx, 1L), maxSize.cx), min(max(size.cy, 1L), maxSize.cy) }; }
+
+	static BOOL IsSameColor(const RGBTRIPLE& rgbt1, const RGBTRIPLE& rgbt2) { return rgbt1.rgbtRed == rgbt2.rgbtRed && rgbt1.rgbtGreen == rgbt2.rgbtGreen && rgbt1.rgbtBlue == rgbt2.rgbtBlue; }
+
+	// Rows that were never written read as white without committing their memory
+	RGBTRIPLE GetPixelColor(LONG x, LONG y) const {
+		const RGBTRIPLE white = { 0xff, 0xff, 0xff };
+		return bitmap.IsMaterialized(y) ? (RGBTRIPLE&)pBits[x * dwPixelSize + y * dwScanLineSize] : white;
+	}
+
+	void BeginPending() {
+		GdiFlush();
+		bitmap.BeginPending();
+		SetRectEmpty(&pendingRect);
+	}
+
+	// Diffs the bands written since BeginPending against their pre-images, only within the pending damage; a band whose
+	// pre-image cannot be read back is left out of the entry and the error is kept for PopError
+	void CommitPending(LPCWSTR lpcwName) {
+		const RECT bitmapRect = GetBitmapRect();
+		RECT rect;
+		GdiFlush();
+		if (IntersectRect(&rect, &pendingRect, &bitmapRect))
+			for (auto it = bitmap.GetPreImages().lower_bound(bitmap.GetBand(rect.top)); it != bitmap.GetPreImages().end() && (LONG)it->first * LAZY_BITMAP_BAND_HEIGHT < rect.bottom; it++) {
+				const LONG lTop = (LONG)it->first * LAZY_BITMAP_BAND_HEIGHT;
+				const std::vector<BYTE>* pPreImage = NULL;
+				if (it->second && (pPreImage = bitmap.GetPreImage(it->second)) == NULL) {
+					dwError = GetLastError();
+					continue;
+				}
+				for (LONG y = max(lTop, rect.top); y < min(lTop + LAZY_BITMAP_BAND_HEIGHT, rect.bottom); y++)
+					for (LONG x = rect.left; x < rect.right; x++) {
+						const DWORD i = x * dwPixelSize + y * dwScanLineSize;
+						const RGBTRIPLE white = { 0xff, 0xff, 0xff }, & rgbt = (RGBTRIPLE&)pBits[i],
+							& previousColor = pPreImage ? (RGBTRIPLE&)(*pPreImage)[i - lTop * dwScanLineSize] : white;
+						if (!IsSameColor(rgbt, previousColor))
+							history.AddPixel({ i, previousColor, rgbt });
+					}
+			}
+		bitmap.EndPending();
+		history.Push(lpcwName, bitmapSize, bitmapSize);
+	}
+
+	// Puts rect back to how it was at BeginPending; its rows must have been written since
+	void RestorePending(const RECT& rect) {
+		const DWORD dwOffset = rect.left * dwPixelSize, dwSize = (rect.right - rect.left) * dwPixelSize;
+		for (auto it = bitmap.GetPreImages().lower_bound(bitmap.GetBand(rect.top)); it != bitmap.GetPreImages().end() && (LONG)it->first * LAZY_BITMAP_BAND_HEIGHT < rect.bottom; it++) {
+			const LONG lTop = (LONG)it->first * LAZY_BITMAP_BAND_HEIGHT;
+			const std::vector<BYTE>* pPreImage = NULL;
+			if (it->second && (pPreImage = bitmap.GetPreImage(it->second)) == NULL) {
+				dwError = GetLastError();
+				continue;
+			}
+			for (LONG y = max(lTop, rect.top); y < min(lTop + LAZY_BITMAP_BAND_HEIGHT, rect.bottom); y++) {
+				const PBYTE pRow = pBits + y * dwScanLineSize + dwOffset;
+				if (pPreImage)
+					CopyMemory(pRow, &(*pPreImage)[(y - lTop) * dwScanLineSize + dwOffset], dwSize);
+				else
+					FillMemory(pRow, dwSize, 0xff);
+			}
+		}
+	}
+
+	// Fills the 4-connected area of the color at point with color, a row span at a time, so only the bands the area
+	// reaches are written and saved, and the canvas stays within its memory budget however large the area is
+	RECT FloodFill(POINT point, COLORREF color) {
+		const RGBTRIPLE target = GetPixelColor(point.x, point.y), fill = { GetBValue(color), GetGValue(color), GetRValue(color) };
+		RECT rect = { 0 };
+		if (IsSameColor(target, fill))
+			return rect;
+		std::vector<POINT> seeds = { point };
+		while (!seeds.empty()) {
+			const POINT seed = seeds.back();
+			seeds.pop_back();
+			if (!IsSameColor(GetPixelColor(seed.x, seed.y), target))
+				continue;
+			LONG lLeft = seed.x, lRight = seed.x + 1;
+			while (lLeft > 0 && IsSameColor(GetPixelColor(lLeft - 1, seed.y), target))
+				lLeft--;
+			while (lRight < bitmapSize.cx && IsSameColor(GetPixelColor(lRight, seed.y), target))
+				lRight++;
+			bitmap.Write(seed.y, seed.y + 1);
+			for (LONG x = lLeft; x < lRight; x++)
+				(RGBTRIPLE&)pBits[x * dwPixelSize + seed.y * dwScanLineSize] = fill;
+			const RECT spanRect = { lLeft, seed.y, lRight, seed.y + 1 };
+			UnionRect(&rect, &rect, &spanRect);
+			// One seed for each run of the target color next to the span, above and below
+			for (const LONG y : { seed.y - 1, seed.y + 1 })
+				if (y >= 0 && y < bitmapSize.cy)
+					for (LONG x = lLeft; x < lRight; x++)
+						if (IsSameColor(GetPixelColor(x, y), target) && (x == lLeft || !IsSameColor(GetPixelColor(x - 1, y), target)))
+							seeds.push_back({ x, y });
+		}
+		return rect;
+	}
+
+	// Commits the rows that dabs between the last stroke position and row fY can reach
+	void WriteStroke(float fY) {
+		bitmap.Write((LONG)floorf(min(fY, fStrokeY) - fStrokeRadius), (LONG)ceilf(max(fY, fStrokeY) + fStrokeRadius));
+		fStrokeY = fY;
+	}
+
+	RECT Execute(const RenderCommand& command) {
+		RECT rect = { 0 };
+		switch (command.Type) {
+		case RenderCommandTypes::BeginStroke: {
+			BeginPending();
+			fStrokeY = command.fY;
+			fStrokeRadius = max(command.fDiameter, BRUSH_MIN_DIAMETER) / 2 + 2;
+			WriteStroke(command.fY);
+			const BrushRect dirtyRect = brushEngine.BeginStroke(pBits, dwScanLineSize, { bitmapSize.cx, bitmapSize.cy }, command.Color, command.fDiameter, command.bHardness, command.fSpacing, command.fX, command.fY, command.fPressure);
+			rect = { dirtyRect.left, dirtyRect.top, dirtyRect.right, dirtyRect.bottom };
+		}	break;
+		case RenderCommandTypes::StrokeTo: {
+			if (bitmap.IsPending()) {
+				WriteStroke(command.fY);
+				const BrushRect dirtyRect = brushEngine.StrokeTo(command.fX, command.fY, command.fPressure);
+				rect = { dirtyRect.left, dirtyRect.top, dirtyRect.right, dirtyRect.bottom };
+			}
+		}	break;
+		case RenderCommandTypes::Fill: {
+			const POINT point = { (LONG)command.fX, (LONG)command.fY };
+			BeginPending();
+			if (point.x >= 0 && point.x < bitmapSize.cx && point.y >= 0 && point.y < bitmapSize.cy)
+				rect = FloodFill(point, command.Color);
+		}	break;
+		case RenderCommandTypes::BeginText: {
+			BeginPending();
+			textEngine.Begin(pBits, dwScanLineSize, bitmapSize, command.Font, command.Color, { (LONG)command.fX, (LONG)command.fY });
+		}	break;
+		case RenderCommandTypes::TypeText: {
+			// Only glyphs that changed or moved are restored and blended again
+			if (bitmap.IsPending() && textEngine.IsActive()) {
+				rect = textEngine.Type(command.wc);
+				if (!IsRectEmpty(&rect)) {
+					bitmap.Write(rect.top, rect.bottom);
+					RestorePending(rect);
+					textEngine.Draw(rect);
+				}
+			}
+		}	break;
+		case RenderCommandTypes::Commit: {
+			textEngine.End();
+			if (bitmap.IsPending())
+				CommitPending(command.lpcwName);
+		}	break;
+		case RenderCommandTypes::Cancel: {
+			textEngine.End();
+			if (bitmap.IsPending()) {
+				if (!bitmap.CancelPending())
+					dwError = GetLastError();
+				rect = pendingRect;
+			}
+		}	break;
+		case RenderCommandTypes::DrawShape: {
+			// Only the shape's bounding box can change, so only that part is saved and compared
+			BeginPending();
+			const RECT bitmapRect = GetBitmapRect();
+			rect = GetShapeBounds(command.DrawnShape);
+			if (IntersectRect(&rect, &rect, &bitmapRect)) {
+				bitmap.Write(rect.top, rect.bottom);
+				DrawShape(hDC_Render, command.DrawnShape);
+				pendingRect = rect;
+			}
+			CommitPending(command.lpcwName);
+		}	break;
+		case RenderCommandTypes::Resize: {
+			// Cropped pixels are still intact in memory, so no copy of the canvas is needed
+			const RGBTRIPLE white = { 0xff, 0xff, 0xff };
+			const SIZE size = ClampSize(command.Size);
+			for (LONG y = 0; y < bitmapSize.cy; y++)
+				for (LONG x = y < size.cy ? size.cx : 0; x < bitmapSize.cx && bitmap.IsMaterialized(y); x++) {
+					const DWORD i = x * dwPixelSize + y * dwScanLineSize;
+					const RGBTRIPLE& rgbt = (RGBTRIPLE&)pBits[i];
+					if (!IsSameColor(rgbt, white))
+						history.AddPixel({ i, rgbt, white });
+				}
+			history.Resize(size);
+			history.Push(L"Resize", bitmapSize, size);
+			bitmapSize = size;
+			rect = GetBitmapRect();
+		}	break;
+		case RenderCommandTypes::Jump: {
+			LARGE_INTEGER startTime, endTime;
+			QueryPerformanceCounter(&startTime);
+			if (!history.Jump(command.uTarget))
+				dwError = GetLastError();
+			bitmapSize = history.GetSize();
+			QueryPerformanceCounter(&endTime);
+			llLastJumpTime = endTime.QuadPart - startTime.QuadPart;
+			rect = GetBitmapRect();
+		}	break;
+		case RenderCommandTypes::Clear: {
+			textEngine.End();
+			bitmap.EndPending();
+			bitmapSize = ClampSize(command.Size);
+			history.Clear(bitmapSize);
+			rect = GetBitmapRect();
+		}	break;
+		case RenderCommandTypes::Barrier: {
+			GdiFlush();
+			SetEvent(command.hEvent);
+		}	break;
+		}
+		return rect;
+	}
+
+	void Run() {
+		RECT damageRect = { 0 };
+		LONGLONG llInputTime = 0, llJumpTime = 0;
+		BOOL bPresentPending = FALSE;
+		for (;;) {
+			RenderCommand command;
+			while (commandQueue.TryPop(command)) {
+				if (command.Type == RenderCommandTypes::Quit)
+					return;
+				opLog.Record(command, command.llInputTime * 1000 / llFrequency);
+				const RECT rect = Render(command);
+				UnionRect(&damageRect, &damageRect, &rect);
+				const DWORD dwError = PopError();
+				if (dwError != ERROR_SUCCESS)
+					PostMessageW(hWnd_Notify, WM_RENDER_ERROR, dwError, 0);
+				llInputTime = max(llInputTime, command.llInputTime);
+				if (command.Type == RenderCommandTypes::Jump)
+					llJumpTime = llLastJumpTime;
+				bPresentPending = TRUE;
+			}
+			if (bPresentPending) {
+				GdiFlush();
+				const PresentItem presentItem = { damageRect, bitmapSize, llInputTime, llJumpTime };
+				if (presentQueue.TryPush(presentItem)) {
+					SetRectEmpty(&damageRect);
+					llInputTime = llJumpTime = 0;
+					bPresentPending = FALSE;
+					if (!bPresentPosted.exchange(true))
+						PostMessageW(hWnd_Notify, WM_RENDER_PRESENT, 0, 0);
+				}
+			}
+			// A full present queue means the UI thread is busy: keep rendering and merge damage until it catches up
+			WaitForSingleObject(hEvent_Command, bPresentPending ? RENDER_PRESENT_RETRY_INTERVAL : INFINITE);
+		}
+	}
+
+	static DWORD WINAPI ThreadProc(LPVOID lpParameter) {
+		((Renderer*)lpParameter)->Run();
+		return 0;
+	}
+
+	static HBITMAP CreateView(HANDLE hSection, SIZE maxSize, PBYTE* ppBits) {
+		BITMAPINFO bitmapInfo = { sizeof(bitmapInfo.bmiHeader) };
+		bitmapInfo.bmiHeader.biWidth = maxSize.cx;
+		bitmapInfo.bmiHeader.biHeight = -maxSize.cy;
+		bitmapInfo.bmiHeader.biPlanes = 1;
+		bitmapInfo.bmiHeader.biBitCount = 24;
+		return CreateDIBSection(NULL, &bitmapInfo, DIB_RGB_COLORS, (LPVOID*)ppBits, hSection, 0);
+	}
+
+	// Creates the canvas memory, its history and the DC that renders into it
+	BOOL Create(SIZE maxSize, SIZE size, SIZE_T uMemoryBudget) {
+		LARGE_INTEGER frequency;
+		QueryPerformanceFrequency(&frequency);
+		llFrequency = frequency.QuadPart;
+		dwScanLineSize = (dwPixelSize * maxSize.cx + 3) & ~3;
+		dwDIBSectionSize = maxSize.cy * dwScanLineSize;
+		this->maxSize = maxSize;
+		bitmapSize = size;
+		HBITMAP hBitmap_Render;
+		hFile = CreateScratchFile(); // falls back to the page file on failure
+		DWORD dwBytesReturned;
+		if (hFile != INVALID_HANDLE_VALUE)
+			DeviceIoControl(hFile, FSCTL_SET_SPARSE, NULL, 0, NULL, 0, &dwBytesReturned, NULL); // only bands written back take disk space
+		if ((hSection = CreateFileMappingW(hFile, NULL, PAGE_READWRITE, 0, dwDIBSectionSize, NULL)) == NULL ||
+			(hBitmap_Render = CreateView(hSection, maxSize, &pBits)) == NULL)
+			return FALSE;
+		hDC_Render = CreateCompatibleDC(NULL);
+		hBitmap_RenderOld = SelectBitmap(hDC_Render, hBitmap_Render);
+		bitmap.Reset(pBits, dwScanLineSize, maxSize.cy, uMemoryBudget / 2);
+		history.Reset(&bitmap, size, uMemoryBudget / 2);
+		return TRUE;
+	}
+
+public:
+	// Creates a white canvas of maxSize pixels, of which size is in use, and starts the render thread.
+	// No canvas memory is touched until it is painted on. The canvas is mapped from a scratch file so that, together with
+	// the history, it can be held to uMemoryBudget bytes of RAM; half of the budget goes to each.
+	// Presents are announced to hWnd_Notify with WM_RENDER_PRESENT; returns FALSE with the last error set on failure.
+	BOOL Start(HWND hWnd_Notify, SIZE maxSize, SIZE size, SIZE_T uMemoryBudget) {
+		this->hWnd_Notify = hWnd_Notify;
+		PBYTE pPresentBits;
+		HBITMAP hBitmap_Present;
+		if (!Create(maxSize, size, uMemoryBudget) ||
+			(hBitmap_Present = CreateView(hSection, maxSize, &pPresentBits)) == NULL)
+			return FALSE;
+		hDC_Present = CreateCompatibleDC(NULL);
+		hBitmap_PresentOld = SelectBitmap(hDC_Present, hBitmap_Present);
+		bitmap.SetAlias(pPresentBits);
+		LARGE_INTEGER counter;
+		QueryPerformanceCounter(&counter);
+		RenderCommand command = { RenderCommandTypes::Clear, counter.QuadPart };
+		command.Size = size;
+		opLog.Record(command, command.llInputTime * 1000 / llFrequency);
+		hEvent_Command = CreateEventW(NULL, FALSE, FALSE, NULL);
+		hEvent_Barrier = CreateEventW(NULL, FALSE, FALSE, NULL);
+		hThread = CreateThread(NULL, 0, ThreadProc, this, 0, NULL);
+		return hThread != NULL;
+	}
+
+	// Same as Start but without a render thread: commands are rendered on the calling thread through Render and nothing is presented
+	BOOL StartHeadless(SIZE maxSize, SIZE size, SIZE_T uMemoryBudget) { return Create(maxSize, size, uMemoryBudget); }
+
+	// Renders one command on the calling thread and returns the damaged rectangle; only for headless renderers and the render thread
+	RECT Render(const RenderCommand& command) {
+		const RECT rect = Execute(command);
+		if (bitmap.IsPending())
+			UnionRect(&pendingRect, &pendingRect, &rect);
+		return rect;
+	}
+
+	// Returns the error of the last command that failed since the last call and forgets it, ERROR_SUCCESS if none did.
+	// Commands only fail when history payloads or pre-images cannot be read back from a scratch file; render threads post
+	// the error with WM_RENDER_ERROR.
+	DWORD PopError() {
+		const DWORD dwError = this->dwError;
+		this->dwError = ERROR_SUCCESS;
+		return dwError;
+	}
+
+	SIZE GetBitmapSize() const { return bitmapSize; }
+
+	// Canvas memory; for headless renderers, which may read it between calls to Render
+	const LazyBitmap& GetBitmap() const { return bitmap; }
+
+	// Copy of every command since the canvas was last cleared; call from the submitting thread after Flush
+	OpLog GetOpLog() const { return opLog; }
+
+	// Never blocks on pixel work; only yields while the command queue is full
+	void Submit(const RenderCommand& command) {
+		while (!commandQueue.TryPush(command))
+			SwitchToThread();
+		SetEvent(hEvent_Command);
+	}
+
+	// Waits until every submitted command has been rendered
+	void Flush() {
+		RenderCommand command = { RenderCommandTypes::Barrier };
+		command.hEvent = hEvent_Barrier;
+		Submit(command);
+		WaitForSingleObject(hEvent_Barrier, INFINITE);
+	}
+
+	// Merges every completed present into one damaged rectangle and returns FALSE if there was none; llJumpTime is in
+	// QueryPerformanceCounter ticks and is 0 unless a history jump was rendered since the last call
+	BOOL PopPresentItems(RECT& damageRect, SIZE& bitmapSize, LONGLONG& llInputTime, LONGLONG& llJumpTime) {
+		bPresentPosted.store(false);
+		BOOL bPopped = FALSE;
+		PresentItem presentItem;
+		SetRectEmpty(&damageRect);
+		llInputTime = llJumpTime = 0;
+		while (presentQueue.TryPop(presentItem)) {
+			UnionRect(&damageRect, &damageRect, &presentItem.DamageRect);
+			bitmapSize = presentItem.BitmapSize;
+			llInputTime = max(llInputTime, presentItem.llInputTime);
+			if (presentItem.llJumpTime)
+				llJumpTime = presentItem.llJumpTime;
+			bPopped = TRUE;
+		}
+		return bPopped;
+	}
+
+	// Copies rect of the canvas to (iX, iY) of hDC_Target, with unwritten bands as white and without committing their memory; called from the UI thread
+	void Copy(HDC hDC_Target, int iX, int iY, const RECT& rect) const { bitmap.Copy(hDC_Target, iX, iY, hDC_Present, rect); }
+
+	// Hints that the canvas rows covered by rect are about to be shown; called from the UI thread
+	void Prefetch(const RECT& rect) const { bitmap.Prefetch(rect.top, rect.bottom); }
+
+	// Canvas hits and misses count band writes; history ones count entry and snapshot reads
+	void GetStatistics(CacheStatistics& canvasStatistics, CacheStatistics& historyStatistics) const {
+		canvasStatistics = bitmap.GetStatistics();
+		historyStatistics = history.GetStatistics();
+	}
+
+	TextStatistics GetTextStatistics() const { return textEngine.GetStatistics(); }
+
+	void Stop() {
+		if (hThread) {
+			const RenderCommand command = { RenderCommandTypes::Quit };
+			Submit(command);
+			WaitForSingleObject(hThread, INFINITE);
+			CloseHandle(hThread);
+			hThread = NULL;
+		}
+		if (hEvent_Barrier)
+			CloseHandle(hEvent_Barrier);
+		if (hEvent_Command)
+			CloseHandle(hEvent_Command);
+		if (hDC_Present) {
+			DeleteBitmap(SelectBitmap(hDC_Present, hBitmap_PresentOld));
+			DeleteDC(hDC_Present);
+		}
+		if (hDC_Render) {
+			DeleteBitmap(SelectBitmap(hDC_Render, hBitmap_RenderOld));
+			DeleteDC(hDC_Render);
+		}
+		if (hSection)
+			CloseHandle(hSection);
+		if (hFile != INVALID_HANDLE_VALUE)
+			CloseHandle(hFile);
+		hEvent_Barrier = hEvent_Command = hSection = NULL;
+		hFile = INVALID_HANDLE_VALUE;
+		hDC_Present = hDC_Render = NULL;
+	}
+};
\ No newline at end of file
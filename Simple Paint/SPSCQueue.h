@@ -0,0 +1,35 @@
+#pragma once
+
+#include <atomic>
+
+// Lock-free ring buffer for exactly one producer thread and one consumer thread; uCapacity must be a power of 2
+template <class T, size_t uCapacity>
+class SPSCQueue {
+private:
+	static_assert(uCapacity && !(uCapacity & (uCapacity - 1)), "capacity must be a power of 2");
+
+	alignas(64) std::atomic<size_t> uHead { 0 }; // next slot to read, written by the consumer only
+	alignas(64) std::atomic<size_t> uTail { 0 }; // next slot to write, written by the producer only
+	alignas(64) T items[uCapacity];
+
+public:
+	bool TryPush(const T& item) {
+		const size_t uCurrentTail = uTail.load(std::memory_order_relaxed);
+		if (uCurrentTail - uHead.load(std::memory_order_acquire) == uCapacity)
+			return false;
+		items[uCurrentTail & (uCapacity - 1)] = item;
+		uTail.store(uCurrentTail + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool TryPop(T& item) {
+		const size_t uCurrentHead = uHead.load(std::memory_order_relaxed);
+		if (uCurrentHead == uTail.load(std::memory_order_acquire))
+			return false;
+		item = items[uCurrentHead & (uCapacity - 1)];
+		uHead.store(uCurrentHead + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool IsEmpty() const { return uHead.load(std::memory_order_acquire) == uTail.load(std::memory_order_acquire); }
+};
\ No newline at end of file
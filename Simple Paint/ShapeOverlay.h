@@ -0,0 +1,107 @@
+#pragma once
+
+#include <Windows.h>
+#include <windowsx.h>
+
+// Copies rect of the canvas to (iX, iY) of hDC_Target
+typedef void (*CanvasCopyProc)(HDC hDC_Target, int iX, int iY, const RECT& rect);
+
+enum class ShapeTypes { Line, Rectangle, Ellipse };
+
+struct Shape {
+	ShapeTypes Type;
+	POINT From, To;
+	COLORREF Color;
+	int iWidth;
+	BOOL bFilled;
+};
+
+RECT GetShapeBounds(const Shape& shape) {
+	RECT rect = { min(shape.From.x, shape.To.x), min(shape.From.y, shape.To.y), max(shape.From.x, shape.To.x) + 1, max(shape.From.y, shape.To.y) + 1 };
+	if (shape.Type == ShapeTypes::Line)
+		InflateRect(&rect, shape.iWidth / 2 + 1, shape.iWidth / 2 + 1);
+	return rect;
+}
+
+void DrawShape(HDC hDC, const Shape& shape) {
+	HPEN hPen = CreatePen(shape.Type == ShapeTypes::Line ? PS_SOLID : PS_INSIDEFRAME, shape.iWidth, shape.Color),
+		hPen_Old = SelectPen(hDC, hPen);
+	HBRUSH hBrush = shape.bFilled ? CreateSolidBrush(shape.Color) : NULL,
+		hBrush_Old = SelectBrush(hDC, hBrush ? hBrush : GetStockBrush(NULL_BRUSH));
+	const RECT rect = GetShapeBounds(shape);
+	switch (shape.Type) {
+	case ShapeTypes::Line: {
+		MoveToEx(hDC, shape.From.x, shape.From.y, NULL);
+		LineTo(hDC, shape.To.x, shape.To.y);
+		SetPixelV(hDC, shape.To.x, shape.To.y, shape.Color);
+	}	break;
+	case ShapeTypes::Rectangle: Rectangle(hDC, rect.left, rect.top, rect.right, rect.bottom); break;
+	case ShapeTypes::Ellipse: Ellipse(hDC, rect.left, rect.top, rect.right, rect.bottom); break;
+	}
+	SelectBrush(hDC, hBrush_Old);
+	SelectPen(hDC, hPen_Old);
+	if (hBrush)
+		DeleteBrush(hBrush);
+	DeletePen(hPen);
+}
+
+// Rubber-band preview composited over the screen without touching the canvas bitmap
+class ShapeOverlay {
+private:
+	HDC hDC_Overlay = NULL;
+	HBITMAP hBitmap_Old = NULL;
+	SIZE bitmapSize = { 0 };
+	RECT shownRect = { 0 };
+
+	// Copies the clean canvas pixels in rect to the screen, with the shape drawn on top if there is one
+	void Compose(HDC hDC_Target, CanvasCopyProc copyCanvas, const RECT& rect, const Shape* pShape) {
+		const SIZE size = { rect.right - rect.left, rect.bottom - rect.top };
+		if (size.cx <= 0 || size.cy <= 0)
+			return;
+		if (pShape == NULL) {
+			copyCanvas(hDC_Target, rect.left, rect.top, rect);
+			return;
+		}
+		if (hDC_Overlay == NULL)
+			hDC_Overlay = CreateCompatibleDC(hDC_Target);
+		if (size.cx > bitmapSize.cx || size.cy > bitmapSize.cy) {
+			bitmapSize = { max(size.cx, bitmapSize.cx), max(size.cy, bitmapSize.cy) };
+			HBITMAP hBitmap = SelectBitmap(hDC_Overlay, CreateCompatibleBitmap(hDC_Target, bitmapSize.cx, bitmapSize.cy));
+			if (hBitmap_Old == NULL)
+				hBitmap_Old = hBitmap;
+			else
+				DeleteBitmap(hBitmap);
+		}
+		copyCanvas(hDC_Overlay, 0, 0, rect);
+		SetViewportOrgEx(hDC_Overlay, -rect.left, -rect.top, NULL);
+		DrawShape(hDC_Overlay, *pShape);
+		SetViewportOrgEx(hDC_Overlay, 0, 0, NULL);
+		BitBlt(hDC_Target, rect.left, rect.top, size.cx, size.cy, hDC_Overlay, 0, 0, SRCCOPY);
+	}
+
+public:
+	// Cost is proportional to the union of the previous and current bounding boxes, not to the canvas size
+	void Show(HDC hDC_Target, CanvasCopyProc copyCanvas, const RECT& clipRect, const Shape& shape) {
+		RECT shapeRect = GetShapeBounds(shape), rect;
+		IntersectRect(&shapeRect, &shapeRect, &clipRect);
+		UnionRect(&rect, &shownRect, &shapeRect);
+		Compose(hDC_Target, copyCanvas, rect, &shape);
+		shownRect = shapeRect;
+	}
+
+	void Hide(HDC hDC_Target, CanvasCopyProc copyCanvas) {
+		Compose(hDC_Target, copyCanvas, shownRect, NULL);
+		SetRectEmpty(&shownRect);
+	}
+
+	// Leaves the preview on screen for the caller to overwrite, e.g. once the shape has been drawn into the canvas
+	void Release() { SetRectEmpty(&shownRect); }
+
+	~ShapeOverlay() {
+		if (hDC_Overlay) {
+			if (hBitmap_Old)
+				DeleteBitmap(SelectBitmap(hDC_Overlay, hBitmap_Old));
+			DeleteDC(hDC_Overlay);
+		}
+	}
+};
\ No newline at end of file
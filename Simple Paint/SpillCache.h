@@ -0,0 +1,166 @@
+#pragma once
+
+#include <Windows.h>
+#include <atomic>
+#include <list>
+#include <unordered_map>
+#include <vector>
+
+#define SPILL_CACHE_MAX_IO_SIZE (1 << 30) // bytes per ReadFile or WriteFile call, which take DWORD sizes
+
+struct CacheStatistics {
+	ULONGLONG ullHits, ullMisses, ullMissMicroseconds; // ullMissMicroseconds is the total time spent reading misses back
+};
+
+// Temporary file that lives on disk only while its handle is open
+HANDLE CreateScratchFile() {
+	WCHAR szPath[MAX_PATH], szFileName[MAX_PATH];
+	if (!GetTempPathW(_countof(szPath), szPath) || !GetTempFileNameW(szPath, L"SP", 0, szFileName))
+		return INVALID_HANDLE_VALUE;
+	return CreateFileW(szFileName, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, NULL);
+}
+
+ULONGLONG GetElapsedMicroseconds(LONGLONG llStartTime) {
+	LARGE_INTEGER frequency, counter;
+	QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&counter);
+	return (ULONGLONG)((counter.QuadPart - llStartTime) * 1000000 / frequency.QuadPart);
+}
+
+// Immutable byte payloads kept in RAM up to a budget. The least recently used ones are written once to a scratch file,
+// released, and read back on their next use. Not thread-safe except for GetStatistics.
+class SpillCache {
+private:
+	struct Payload {
+		std::vector<BYTE> Bytes; // empty while spilled
+		SIZE_T uSize;
+		LONGLONG llOffset; // position in the scratch file once written, -1 before
+		BOOL bResident;
+		std::list<ULONGLONG>::iterator LRUPosition; // valid while resident
+	};
+
+	HANDLE hFile = INVALID_HANDLE_VALUE;
+	LONGLONG llFileSize = 0;
+	SIZE_T uBudget = SIZE_MAX, uResidentSize = 0;
+	ULONGLONG ullNextId = 1;
+	std::unordered_map<ULONGLONG, Payload> payloads;
+	std::list<ULONGLONG> lru; // most recently used first
+	std::atomic<ULONGLONG> ullHits { 0 }, ullMisses { 0 }, ullMissMicroseconds { 0 };
+
+	// Transfers uSize bytes at llOffset of the scratch file in pieces of at most SPILL_CACHE_MAX_IO_SIZE bytes;
+	// returns FALSE with the last error set if any piece fails or falls short
+	BOOL Transfer(PBYTE pBytes, SIZE_T uSize, LONGLONG llOffset, BOOL bWrite) {
+		while (uSize) {
+			const DWORD dwSize = (DWORD)min(uSize, (SIZE_T)SPILL_CACHE_MAX_IO_SIZE);
+			OVERLAPPED overlapped = { 0 };
+			overlapped.Offset = (DWORD)llOffset;
+			overlapped.OffsetHigh = (DWORD)(llOffset >> 32);
+			DWORD dwTransferred;
+			if (!(bWrite ? WriteFile(hFile, pBytes, dwSize, &dwTransferred, &overlapped) : ReadFile(hFile, pBytes, dwSize, &dwTransferred, &overlapped)))
+				return FALSE;
+			if (dwTransferred != dwSize) {
+				SetLastError(bWrite ? ERROR_DISK_FULL : ERROR_HANDLE_EOF);
+				return FALSE;
+			}
+			pBytes += dwSize;
+			uSize -= dwSize;
+			llOffset += dwSize;
+		}
+		return TRUE;
+	}
+
+	BOOL Spill(Payload& payload) {
+		if (payload.llOffset < 0) {
+			if (hFile == INVALID_HANDLE_VALUE && (hFile = CreateScratchFile()) == INVALID_HANDLE_VALUE)
+				return FALSE;
+			if (!Transfer(payload.Bytes.data(), payload.uSize, llFileSize, TRUE))
+				return FALSE;
+			payload.llOffset = llFileSize;
+			llFileSize += payload.uSize;
+		}
+		std::vector<BYTE>().swap(payload.Bytes);
+		lru.erase(payload.LRUPosition);
+		payload.bResident = FALSE;
+		uResidentSize -= payload.uSize;
+		return TRUE;
+	}
+
+	void Admit(ULONGLONG ullId, Payload& payload) {
+		lru.push_front(ullId);
+		payload.LRUPosition = lru.begin();
+		payload.bResident = TRUE;
+		uResidentSize += payload.uSize;
+		while (uResidentSize > uBudget && lru.size() > 1)
+			if (!Spill(payloads.at(lru.back())))
+				break; // keep everything in RAM rather than lose data if the scratch file is unusable
+	}
+
+public:
+	~SpillCache() {
+		if (hFile != INVALID_HANDLE_VALUE)
+			CloseHandle(hFile);
+	}
+
+	void SetBudget(SIZE_T uBudget) { this->uBudget = uBudget; }
+
+	// Returns an id that is never 0
+	ULONGLONG Add(std::vector<BYTE>&& bytes) {
+		const ULONGLONG ullId = ullNextId++;
+		Payload& payload = payloads[ullId];
+		payload.uSize = bytes.size();
+		payload.Bytes = std::move(bytes);
+		payload.llOffset = -1;
+		Admit(ullId, payload);
+		return ullId;
+	}
+
+	// The pointer stays valid until the next call that adds or reads a payload. Returns NULL with the last error set if
+	// a spilled payload cannot be read back; it stays spilled, so a later call may still succeed.
+	const std::vector<BYTE>* Get(ULONGLONG ullId) {
+		Payload& payload = payloads.at(ullId);
+		if (payload.bResident) {
+			ullHits++;
+			lru.splice(lru.begin(), lru, payload.LRUPosition);
+			return &payload.Bytes;
+		}
+		LARGE_INTEGER startTime;
+		QueryPerformanceCounter(&startTime);
+		payload.Bytes.resize(payload.uSize);
+		if (!Transfer(payload.Bytes.data(), payload.uSize, payload.llOffset, FALSE)) {
+			const DWORD dwLastError = GetLastError();
+			std::vector<BYTE>().swap(payload.Bytes);
+			SetLastError(dwLastError);
+			return NULL;
+		}
+		ullMisses++;
+		ullMissMicroseconds += GetElapsedMicroseconds(startTime.QuadPart);
+		Admit(ullId, payload);
+		return &payload.Bytes;
+	}
+
+	SIZE_T GetSize(ULONGLONG ullId) const { return payloads.at(ullId).uSize; }
+
+	SIZE_T GetResidentSize() const { return uResidentSize; }
+
+	// The payload's space in the scratch file is only reclaimed by Clear
+	void Remove(ULONGLONG ullId) {
+		const auto it = payloads.find(ullId);
+		if (it == payloads.end())
+			return;
+		if (it->second.bResident) {
+			lru.erase(it->second.LRUPosition);
+			uResidentSize -= it->second.uSize;
+		}
+		payloads.erase(it);
+	}
+
+	// Drops every payload; space in the scratch file is reused from the start
+	void Clear() {
+		payloads.clear();
+		lru.clear();
+		uResidentSize = 0;
+		llFileSize = 0;
+	}
+
+	CacheStatistics GetStatistics() const { return { ullHits, ullMisses, ullMissMicroseconds }; }
+};
\ No newline at end of file
@@ -0,0 +1,579 @@
+#pragma once
+
+#include <Windows.h>
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <list>
+#include <memory>
+#include <string>
+#include <vector>
+#include "OpLog.h"
+#include "Renderer.h"
+#include "SPSCQueue.h"
+
+#define WM_SYNC_RECEIVE (WM_APP + 4)
+#define WM_SYNC_DISCONNECTED (WM_APP + 5) // wParam: error code, lParam: session that ended, as returned by SyncReplica::GetSession
+#define SYNC_PIPE_NAME L"\\\\.\\pipe\\SimplePaint.Sync"
+#define SYNC_COORDINATOR_SWITCH L"/coordinator"
+#define SYNC_JOIN_SWITCH L"/join"
+#define SYNC_PIPE_BUFFER_SIZE 0x10000
+#define SYNC_RECEIVE_QUEUE_SIZE 256
+#define SYNC_CONNECT_TIMEOUT 5000 // milliseconds to reach a coordinator, and for a new coordinator to be reached
+#define SYNC_ECHO_TIMEOUT 5000
+#define SYNC_RETRY_INTERVAL 50
+#define SYNC_STATISTICS_INTERVAL 1000
+
+// Every pipe message starts with one of these, followed by op log bytes
+enum class SyncMessageTypes : BYTE {
+	Join, // replica to coordinator: the replica's whole log, which seeds the session if it is the first replica
+	Batch, // both ways: ops that must be applied together; the coordinator sends them on in the order it received them
+	Echo // coordinator to replica: a Batch that the replica itself sent, in its place in the order
+};
+
+// Message-mode pipe I/O on handles opened for overlapped I/O; both wait for their own completion
+BOOL ReadPipeMessage(HANDLE hPipe, HANDLE hEvent, std::vector<BYTE>& message) {
+	size_t uSize = 0;
+	message.resize(SYNC_PIPE_BUFFER_SIZE);
+	for (;;) {
+		OVERLAPPED overlapped = { 0 };
+		overlapped.hEvent = hEvent;
+		DWORD dwBytesRead;
+		if (!ReadFile(hPipe, message.data() + uSize, (DWORD)(message.size() - uSize), NULL, &overlapped) &&
+			GetLastError() != ERROR_IO_PENDING && GetLastError() != ERROR_MORE_DATA)
+			return FALSE;
+		if (GetOverlappedResult(hPipe, &overlapped, &dwBytesRead, TRUE)) {
+			message.resize(uSize + dwBytesRead);
+			return TRUE;
+		}
+		if (GetLastError() != ERROR_MORE_DATA)
+			return FALSE;
+		uSize += dwBytesRead;
+		message.resize(message.size() * 2);
+	}
+}
+
+BOOL WritePipeMessage(HANDLE hPipe, HANDLE hEvent, SyncMessageTypes type, const std::vector<BYTE>& ops) {
+	std::vector<BYTE> message(1 + ops.size());
+	message[0] = (BYTE)type;
+	std::copy(ops.begin(), ops.end(), message.begin() + 1);
+	OVERLAPPED overlapped = { 0 };
+	overlapped.hEvent = hEvent;
+	DWORD dwBytesWritten;
+	if (!WriteFile(hPipe, message.data(), (DWORD)message.size(), NULL, &overlapped) && GetLastError() != ERROR_IO_PENDING)
+		return FALSE;
+	return GetOverlappedResult(hPipe, &overlapped, &dwBytesWritten, TRUE);
+}
+
+// Runs in a process of its own, started with SYNC_COORDINATOR_SWITCH by the first replica that finds no pipe.
+// Puts the batches of all replicas in one order and sends each to every replica, so that all of them render the same
+// commands in the same sequence. The batches since the last Clear are kept for replicas that join later.
+// Replicas are not trusted: one that sends anything but a Join followed by Batches of well-formed op logs is dropped.
+// Every replica has a reader thread, which orders its batches under the lock, and a writer thread, which sends what is
+// queued for it outside the lock, so a replica that reads slowly only holds up its own queue.
+class SyncCoordinator {
+private:
+	struct OutgoingMessage {
+		SyncMessageTypes Type;
+		std::shared_ptr<const std::vector<BYTE>> Ops; // shared by the queues of all replicas and the session
+	};
+
+	struct Client {
+		SyncCoordinator* pCoordinator;
+		HANDLE hPipe, hEvent_Read, hEvent_Write, hEvent_Outgoing, hWriter;
+		BOOL bJoined, bClosing;
+		std::deque<OutgoingMessage> outgoing;
+	};
+
+	LPCWSTR lpcwPipeName;
+	CRITICAL_SECTION criticalSection;
+	HANDLE hEvent_Idle; // set when the last replica has left
+	std::list<Client> clients;
+	std::vector<std::shared_ptr<const std::vector<BYTE>>> session; // batches since the last Clear, in order
+
+	// Must be called under the lock
+	static void Enqueue(Client& client, SyncMessageTypes type, const std::shared_ptr<const std::vector<BYTE>>& ops) {
+		client.outgoing.push_back({ type, ops });
+		SetEvent(client.hEvent_Outgoing);
+	}
+
+	void Write(Client& client) {
+		std::deque<OutgoingMessage> messages;
+		for (BOOL bClosing = FALSE; !bClosing;) {
+			WaitForSingleObject(client.hEvent_Outgoing, INFINITE);
+			EnterCriticalSection(&criticalSection);
+			messages.swap(client.outgoing);
+			bClosing = client.bClosing;
+			LeaveCriticalSection(&criticalSection);
+			for (; !messages.empty(); messages.pop_front())
+				if (!WritePipeMessage(client.hPipe, client.hEvent_Write, messages.front().Type, *messages.front().Ops)) {
+					CancelIoEx(client.hPipe, NULL); // ends the reader too
+					return;
+				}
+		}
+	}
+
+	void Serve(Client& client) {
+		std::vector<BYTE> message;
+		while (ReadPipeMessage(client.hPipe, client.hEvent_Read, message) && !message.empty()) {
+			const SyncMessageTypes type = (SyncMessageTypes)message[0];
+			const auto ops = std::make_shared<const std::vector<BYTE>>(message.begin() + 1, message.end());
+			if (type != (client.bJoined ? SyncMessageTypes::Batch : SyncMessageTypes::Join) || !OpLog(*ops).IsWellFormed())
+				break;
+			EnterCriticalSection(&criticalSection);
+			switch (type) {
+			case SyncMessageTypes::Join: {
+				if (session.empty())
+					session.push_back(ops);
+				else
+					for (const auto& batch : session)
+						Enqueue(client, SyncMessageTypes::Batch, batch);
+				client.bJoined = TRUE;
+			}	break;
+			case SyncMessageTypes::Batch: {
+				if (!ops->empty() && (*ops)[0] == (BYTE)RenderCommandTypes::Clear)
+					session.clear();
+				for (auto& other : clients)
+					if (other.bJoined)
+						Enqueue(other, &other == &client ? SyncMessageTypes::Echo : SyncMessageTypes::Batch, ops);
+				session.push_back(ops);
+			}	break;
+			}
+			LeaveCriticalSection(&criticalSection);
+		}
+		EnterCriticalSection(&criticalSection);
+		client.bClosing = TRUE;
+		SetEvent(client.hEvent_Outgoing);
+		LeaveCriticalSection(&criticalSection);
+		CancelIoEx(client.hPipe, NULL); // a writer blocked on a replica that stopped reading
+		WaitForSingleObject(client.hWriter, INFINITE);
+		DisconnectNamedPipe(client.hPipe);
+		CloseHandle(client.hWriter);
+		CloseHandle(client.hPipe);
+		CloseHandle(client.hEvent_Read);
+		CloseHandle(client.hEvent_Write);
+		CloseHandle(client.hEvent_Outgoing);
+		EnterCriticalSection(&criticalSection);
+		for (auto it = clients.begin(); it != clients.end(); it++)
+			if (&*it == &client) {
+				clients.erase(it);
+				break;
+			}
+		if (clients.empty())
+			SetEvent(hEvent_Idle);
+		LeaveCriticalSection(&criticalSection);
+	}
+
+	static DWORD WINAPI ReaderProc(LPVOID lpParameter) {
+		Client* pClient = (Client*)lpParameter;
+		pClient->pCoordinator->Serve(*pClient);
+		return 0;
+	}
+
+	static DWORD WINAPI WriterProc(LPVOID lpParameter) {
+		Client* pClient = (Client*)lpParameter;
+		pClient->pCoordinator->Write(*pClient);
+		return 0;
+	}
+
+public:
+	SyncCoordinator(LPCWSTR lpcwPipeName = SYNC_PIPE_NAME) : lpcwPipeName(lpcwPipeName) {
+		InitializeCriticalSection(&criticalSection);
+		hEvent_Idle = CreateEventW(NULL, TRUE, FALSE, NULL);
+	}
+
+	~SyncCoordinator() {
+		CloseHandle(hEvent_Idle);
+		DeleteCriticalSection(&criticalSection);
+	}
+
+	// Serves replicas until the last one leaves, or until none connects in time; returns an exit code for the process
+	int Run() {
+		HANDLE hEvent_Connect = CreateEventW(NULL, TRUE, FALSE, NULL);
+		std::vector<HANDLE> readers;
+		int iExitCode = 0;
+		for (BOOL bFirst = TRUE;; bFirst = FALSE) {
+			// Only one coordinator may own the pipe name
+			HANDLE hPipe = CreateNamedPipeW(lpcwPipeName,
+				PIPE_ACCESS_DUPLEX | FILE_FLAG_OVERLAPPED | (bFirst ? FILE_FLAG_FIRST_PIPE_INSTANCE : 0),
+				PIPE_TYPE_MESSAGE | PIPE_READMODE_MESSAGE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS,
+				PIPE_UNLIMITED_INSTANCES, SYNC_PIPE_BUFFER_SIZE, SYNC_PIPE_BUFFER_SIZE, 0, NULL);
+			if (hPipe == INVALID_HANDLE_VALUE) {
+				iExitCode = (int)GetLastError();
+				break;
+			}
+			OVERLAPPED overlapped = { 0 };
+			overlapped.hEvent = hEvent_Connect;
+			DWORD dwBytesTransferred;
+			BOOL bConnected = ConnectNamedPipe(hPipe, &overlapped) || GetLastError() == ERROR_PIPE_CONNECTED;
+			if (!bConnected && GetLastError() == ERROR_IO_PENDING) {
+				// Replicas are only added by this thread, so once the last one has left, none can come back
+				const HANDLE handles[] = { hEvent_Connect, hEvent_Idle };
+				bConnected = WaitForMultipleObjects(_countof(handles), handles, FALSE, bFirst ? SYNC_CONNECT_TIMEOUT : INFINITE) == WAIT_OBJECT_0 &&
+					GetOverlappedResult(hPipe, &overlapped, &dwBytesTransferred, FALSE);
+			}
+			if (!bConnected) {
+				const DWORD dwLastError = GetLastError();
+				CancelIo(hPipe);
+				GetOverlappedResult(hPipe, &overlapped, &dwBytesTransferred, TRUE);
+				CloseHandle(hPipe);
+				if (!bFirst && WaitForSingleObject(hEvent_Idle, 0) != WAIT_OBJECT_0)
+					iExitCode = (int)dwLastError;
+				break;
+			}
+			ResetEvent(hEvent_Connect);
+			EnterCriticalSection(&criticalSection);
+			ResetEvent(hEvent_Idle);
+			clients.push_back({ this, hPipe, CreateEventW(NULL, TRUE, FALSE, NULL), CreateEventW(NULL, TRUE, FALSE, NULL), CreateEventW(NULL, FALSE, FALSE, NULL) });
+			Client& client = clients.back();
+			HANDLE hReader = NULL;
+			if ((client.hWriter = CreateThread(NULL, 0, WriterProc, &client, 0, NULL)) == NULL ||
+				(hReader = CreateThread(NULL, 0, ReaderProc, &client, 0, NULL)) == NULL) {
+				if (client.hWriter) {
+					client.bClosing = TRUE;
+					SetEvent(client.hEvent_Outgoing);
+					WaitForSingleObject(client.hWriter, INFINITE);
+					CloseHandle(client.hWriter);
+				}
+				CloseHandle(client.hPipe);
+				CloseHandle(client.hEvent_Read);
+				CloseHandle(client.hEvent_Write);
+				CloseHandle(client.hEvent_Outgoing);
+				clients.pop_back();
+				if (clients.empty())
+					SetEvent(hEvent_Idle);
+			}
+			LeaveCriticalSection(&criticalSection);
+			if (hReader)
+				readers.push_back(hReader);
+			// Forget the readers of replicas that have left
+			for (auto it = readers.begin(); it != readers.end();)
+				if (WaitForSingleObject(*it, 0) == WAIT_OBJECT_0) {
+					CloseHandle(*it);
+					it = readers.erase(it);
+				}
+				else
+					it++;
+		}
+		for (HANDLE hReader : readers) {
+			WaitForSingleObject(hReader, INFINITE);
+			CloseHandle(hReader);
+		}
+		CloseHandle(hEvent_Connect);
+		return iExitCode;
+	}
+};
+
+struct SyncMessage {
+	BOOL bEcho;
+	std::vector<BYTE> Ops;
+};
+
+// Applies a command in its final place in the shared order: renders it and mirrors its effect on the history
+typedef void (*CommandProc)(const RenderCommand& command);
+
+// Replica side of a shared canvas. Commands go to the coordinator and are only applied when they come back in the shared
+// order, which makes every replica render the same commands in the same sequence. Strokes, fills and text are still drawn
+// at once as pending operations and sent as one batch when they are committed; remote batches that arrive meanwhile wait.
+// When the echo comes back with nothing ordered before it, only the commit is left to apply; otherwise the local
+// pending operation is cancelled and redrawn after the batches that won the race. An operation begun before the echo of
+// the previous one takes the previous one back, to be applied in full when its echo comes, so the UI never waits for
+// the coordinator. Batches are checked on the reader thread; a malformed one ends the session with ERROR_INVALID_DATA.
+// Everything but the reader thread runs on the UI thread.
+class SyncReplica {
+private:
+	HWND hWnd_Notify;
+	HANDLE hPipe = INVALID_HANDLE_VALUE, hThread = NULL, hEvent_Read = NULL, hEvent_Write = NULL, hEvent_Received = NULL;
+	Renderer* pRenderer;
+	CommandProc applyProc;
+	std::atomic<bool> bLeaving { false }, bReceivePosted { false };
+	SPSCQueue<SyncMessage, SYNC_RECEIVE_QUEUE_SIZE> receiveQueue;
+	OpLog localBatch;
+	BOOL bLocalPending = FALSE; // a local stroke, fill or text is drawn but not yet applied in the shared order
+	RenderCommand localCommit;
+	struct SentBatch {
+		LONGLONG llSendTime;
+		std::vector<BYTE> TakenBackOps; // of a local operation that was taken back, which Leave applies if its echo never came
+	};
+
+	std::vector<std::vector<BYTE>> deferredBatches; // batches ordered before the local pending operation and held back by it
+	std::deque<SentBatch> sentBatches; // not yet echoed, oldest first
+	size_t uEarlierEchoes = 0; // echoes due before the one of the local pending operation
+	UINT uSession = 0;
+	ULONGLONG ullOpCount = 0, ullEchoCount = 0, ullRoundTripTicks = 0;
+	LONGLONG llStatisticsTime = 0;
+
+	static LONGLONG GetTime() {
+		LARGE_INTEGER counter;
+		QueryPerformanceCounter(&counter);
+		return counter.QuadPart;
+	}
+
+	// Applies the ops of a batch through applyProc, from the uFirst-th one on
+	void Apply(const std::vector<BYTE>& ops, size_t uFirst = 0) {
+		const OpLog opLog(ops);
+		OpLog::Reader reader(opLog);
+		RenderCommand command;
+		for (size_t i = 0; reader.Read(command); i++)
+			if (i >= uFirst) {
+				command.llInputTime = GetTime();
+				applyProc(command);
+				ullOpCount++;
+			}
+	}
+
+	void ApplyDeferred() {
+		for (const auto& batch : deferredBatches)
+			Apply(batch);
+		deferredBatches.clear();
+	}
+
+	BOOL Send(const OpLog& batch) {
+		sentBatches.push_back({ GetTime() });
+		return WritePipeMessage(hPipe, hEvent_Write, SyncMessageTypes::Batch, batch.GetBytes());
+	}
+
+	// Cancels the drawing of the local pending operation; if it has been sent, its echo applies it like any other batch
+	void TakeBack() {
+		const RenderCommand command = { RenderCommandTypes::Cancel, GetTime() };
+		pRenderer->Submit(command);
+		if (sentBatches.size() > uEarlierEchoes)
+			sentBatches[uEarlierEchoes].TakenBackOps = localBatch.GetBytes();
+		bLocalPending = FALSE;
+		ApplyDeferred();
+	}
+
+	void Run() {
+		std::vector<BYTE> message;
+		BOOL bMalformed = FALSE;
+		while (ReadPipeMessage(hPipe, hEvent_Read, message) && !message.empty()) {
+			const SyncMessage syncMessage = { message[0] == (BYTE)SyncMessageTypes::Echo, std::vector<BYTE>(message.begin() + 1, message.end()) };
+			// Nothing is applied from a batch unless all of it can be read
+			if ((message[0] != (BYTE)SyncMessageTypes::Batch && !syncMessage.bEcho) || !OpLog(syncMessage.Ops).IsWellFormed()) {
+				bMalformed = TRUE;
+				break;
+			}
+			while (!receiveQueue.TryPush(syncMessage)) {
+				if (bLeaving)
+					return;
+				SwitchToThread();
+			}
+			SetEvent(hEvent_Received);
+			if (!bReceivePosted.exchange(true))
+				PostMessageW(hWnd_Notify, WM_SYNC_RECEIVE, 0, 0);
+		}
+		if (!bLeaving)
+			PostMessageW(hWnd_Notify, WM_SYNC_DISCONNECTED, bMalformed ? ERROR_INVALID_DATA : GetLastError(), uSession);
+	}
+
+	static DWORD WINAPI ThreadProc(LPVOID lpParameter) {
+		((SyncReplica*)lpParameter)->Run();
+		return 0;
+	}
+
+	static BOOL StartCoordinator() {
+		WCHAR szProgramFileName[MAX_PATH];
+		GetModuleFileNameW(NULL, szProgramFileName, _countof(szProgramFileName));
+		std::wstring commandLine = L"\"" + std::wstring(szProgramFileName) + L"\" " SYNC_COORDINATOR_SWITCH;
+		STARTUPINFOW startupInfo = { sizeof(startupInfo) };
+		PROCESS_INFORMATION processInfo;
+		if (!CreateProcessW(szProgramFileName, &commandLine[0], NULL, NULL, FALSE, 0, NULL, NULL, &startupInfo, &processInfo))
+			return FALSE;
+		CloseHandle(processInfo.hProcess);
+		CloseHandle(processInfo.hThread);
+		return TRUE;
+	}
+
+public:
+	// Connects to the coordinator, starting one if there is none, and sends it opLog, the whole log of renderer.
+	// The first replica's log becomes the shared canvas; later ones are replaced by it. Received batches are announced
+	// to hWnd_Notify with WM_SYNC_RECEIVE, a lost coordinator with WM_SYNC_DISCONNECTED; returns FALSE with the last error set on failure.
+	// Coordinators are only started for the default pipe; on any other one the coordinator must be running already.
+	BOOL Join(HWND hWnd_Notify, Renderer& renderer, const OpLog& opLog, CommandProc applyProc, LPCWSTR lpcwPipeName = SYNC_PIPE_NAME) {
+		uSession++;
+		this->hWnd_Notify = hWnd_Notify;
+		pRenderer = &renderer;
+		this->applyProc = applyProc;
+		BOOL bCoordinatorStarted = wcscmp(lpcwPipeName, SYNC_PIPE_NAME) != 0;
+		for (const ULONGLONG ullDeadline = GetTickCount64() + SYNC_CONNECT_TIMEOUT;;) {
+			if ((hPipe = CreateFileW(lpcwPipeName, GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, FILE_FLAG_OVERLAPPED, NULL)) != INVALID_HANDLE_VALUE)
+				break;
+			const DWORD dwLastError = GetLastError();
+			if ((dwLastError != ERROR_FILE_NOT_FOUND && dwLastError != ERROR_PIPE_BUSY) || GetTickCount64() >= ullDeadline ||
+				(dwLastError == ERROR_FILE_NOT_FOUND && !bCoordinatorStarted && !(bCoordinatorStarted = StartCoordinator())))
+				return FALSE;
+			if (dwLastError == ERROR_PIPE_BUSY)
+				WaitNamedPipeW(lpcwPipeName, SYNC_RETRY_INTERVAL);
+			else
+				Sleep(SYNC_RETRY_INTERVAL);
+		}
+		DWORD dwMode = PIPE_READMODE_MESSAGE;
+		hEvent_Read = CreateEventW(NULL, TRUE, FALSE, NULL);
+		hEvent_Write = CreateEventW(NULL, TRUE, FALSE, NULL);
+		hEvent_Received = CreateEventW(NULL, FALSE, FALSE, NULL);
+		bLeaving = false;
+		if (!SetNamedPipeHandleState(hPipe, &dwMode, NULL, NULL) ||
+			!WritePipeMessage(hPipe, hEvent_Write, SyncMessageTypes::Join, opLog.GetBytes()) ||
+			(hThread = CreateThread(NULL, 0, ThreadProc, this, 0, NULL)) == NULL) {
+			const DWORD dwLastError = GetLastError();
+			Leave();
+			SetLastError(dwLastError);
+			return FALSE;
+		}
+		llStatisticsTime = GetTime();
+		return TRUE;
+	}
+
+	BOOL IsJoined() const { return hPipe != INVALID_HANDLE_VALUE; }
+
+	// Counts joins, so that a WM_SYNC_DISCONNECTED posted for an earlier session can be told apart
+	UINT GetSession() const { return uSession; }
+
+	// Takes a command issued by the local user
+	void Issue(const RenderCommand& command) {
+		switch (command.Type) {
+		case RenderCommandTypes::BeginStroke: case RenderCommandTypes::Fill: case RenderCommandTypes::BeginText: {
+			if (bLocalPending)
+				TakeBack();
+			uEarlierEchoes = sentBatches.size();
+			localBatch = OpLog();
+			bLocalPending = TRUE;
+			localBatch.Record(command, 0);
+			pRenderer->Submit(command);
+		}	break;
+		case RenderCommandTypes::StrokeTo: case RenderCommandTypes::TypeText: {
+			localBatch.Record(command, 0);
+			pRenderer->Submit(command);
+		}	break;
+		case RenderCommandTypes::Cancel: {
+			pRenderer->Submit(command);
+			bLocalPending = FALSE;
+			ApplyDeferred();
+		}	break;
+		case RenderCommandTypes::Commit: {
+			localBatch.Record(command, 0);
+			localCommit = command;
+			Send(localBatch);
+		}	break;
+		default: {
+			OpLog batch;
+			batch.Record(command, 0);
+			Send(batch);
+		}	break;
+		}
+	}
+
+	// Applies the batches received so far; called on WM_SYNC_RECEIVE
+	void Receive() {
+		bReceivePosted.store(false);
+		SyncMessage message;
+		while (receiveQueue.TryPop(message))
+			if (message.bEcho) {
+				if (!sentBatches.empty()) {
+					ullRoundTripTicks += GetTime() - sentBatches.front().llSendTime;
+					ullEchoCount++;
+					sentBatches.pop_front();
+				}
+				if (uEarlierEchoes) {
+					// Sent before the local pending operation began, so it waits like a remote batch
+					uEarlierEchoes--;
+					if (bLocalPending)
+						deferredBatches.push_back(std::move(message.Ops));
+					else
+						Apply(message.Ops);
+				}
+				else if (!bLocalPending)
+					Apply(message.Ops);
+				else {
+					if (deferredBatches.empty()) {
+						// Everything before the commit is drawn already
+						applyProc(localCommit);
+						ullOpCount++;
+					}
+					else {
+						const RenderCommand command = { RenderCommandTypes::Cancel, GetTime() };
+						pRenderer->Submit(command);
+						ApplyDeferred();
+						Apply(message.Ops);
+					}
+					bLocalPending = FALSE;
+				}
+			}
+			else if (bLocalPending)
+				deferredBatches.push_back(std::move(message.Ops));
+			else
+				Apply(message.Ops);
+	}
+
+	// Applies received batches until every batch sent has come back, so that the history mirror is current.
+	// Leaves the session if the coordinator does not answer in time.
+	void WaitForEchoes() {
+		for (const ULONGLONG ullDeadline = GetTickCount64() + SYNC_ECHO_TIMEOUT; IsJoined() && !sentBatches.empty();) {
+			if (GetTickCount64() >= ullDeadline) {
+				Leave();
+				PostMessageW(hWnd_Notify, WM_SYNC_DISCONNECTED, ERROR_TIMEOUT, uSession);
+				break;
+			}
+			WaitForSingleObject(hEvent_Received, SYNC_RETRY_INTERVAL);
+			Receive();
+		}
+	}
+
+	// Returns FALSE until SYNC_STATISTICS_INTERVAL has passed since the last call that returned TRUE; ullRoundTripMicroseconds
+	// is the mean time from sending a batch to receiving its echo in that interval, 0 if nothing was sent
+	BOOL GetStatistics(float& fOpsPerSecond, ULONGLONG& ullRoundTripMicroseconds) {
+		LARGE_INTEGER frequency;
+		QueryPerformanceFrequency(&frequency);
+		const LONGLONG llTime = GetTime();
+		if ((llTime - llStatisticsTime) * 1000 < SYNC_STATISTICS_INTERVAL * frequency.QuadPart)
+			return FALSE;
+		fOpsPerSecond = ullOpCount * (float)frequency.QuadPart / (llTime - llStatisticsTime);
+		ullRoundTripMicroseconds = ullEchoCount ? ullRoundTripTicks * 1000000 / ullEchoCount / frequency.QuadPart : 0;
+		ullOpCount = ullEchoCount = ullRoundTripTicks = 0;
+		llStatisticsTime = llTime;
+		return TRUE;
+	}
+
+	// Local operations whose echoes never came are kept locally, in the order they were sent
+	void Leave() {
+		if (hThread) {
+			bLeaving = true;
+			do
+				CancelIoEx(hPipe, NULL);
+			while (WaitForSingleObject(hThread, SYNC_RETRY_INTERVAL) == WAIT_TIMEOUT);
+			CloseHandle(hThread);
+			hThread = NULL;
+		}
+		if (hPipe != INVALID_HANDLE_VALUE)
+			CloseHandle(hPipe);
+		if (hEvent_Read)
+			CloseHandle(hEvent_Read);
+		if (hEvent_Write)
+			CloseHandle(hEvent_Write);
+		if (hEvent_Received)
+			CloseHandle(hEvent_Received);
+		hPipe = INVALID_HANDLE_VALUE;
+		hEvent_Read = hEvent_Write = hEvent_Received = NULL;
+		SyncMessage message;
+		while (receiveQueue.TryPop(message));
+		bReceivePosted = false;
+		deferredBatches.clear();
+		const BOOL bTakenBack = std::any_of(sentBatches.cbegin(), sentBatches.cend(), [](const SentBatch& sentBatch) { return !sentBatch.TakenBackOps.empty(); });
+		if (bTakenBack) {
+			// The pending operation is drawn after the ones taken back, as it was begun after them
+			if (bLocalPending) {
+				const RenderCommand command = { RenderCommandTypes::Cancel, GetTime() };
+				pRenderer->Submit(command);
+			}
+			for (const auto& sentBatch : sentBatches)
+				Apply(sentBatch.TakenBackOps);
+			if (bLocalPending)
+				Apply(localBatch.GetBytes());
+		}
+		else if (bLocalPending && sentBatches.size() > uEarlierEchoes)
+			applyProc(localCommit);
+		bLocalPending = FALSE;
+		sentBatches.clear();
+		uEarlierEchoes = 0;
+	}
+};
\ No newline at end of file
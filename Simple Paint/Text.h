@@ -0,0 +1,166 @@
+#pragma once
+
+#include <Windows.h>
+#include <windowsx.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include "GlyphAtlas.h"
+#include "SpillCache.h"
+
+struct TextFont {
+	LPCWSTR lpcwFace; // must live as long as the process
+	LONG lHeight; // em height in pixels
+	LONG lWeight;
+	BOOL bItalic;
+};
+
+struct TextStatistics {
+	CacheStatistics Atlas; // misses are glyphs rasterized cold, ullMissMicroseconds the time spent rasterizing and packing them
+	ULONGLONG ullGlyphsDrawn, ullDrawMicroseconds; // glyphs blended from the atlas
+};
+
+HFONT CreateTextFont(const TextFont& font) {
+	return CreateFontW(-font.lHeight, 0, 0, 0, font.lWeight, font.bItalic, FALSE, FALSE, DEFAULT_CHARSET,
+		OUT_TT_PRECIS, CLIP_DEFAULT_PRECIS, ANTIALIASED_QUALITY, DEFAULT_PITCH, font.lpcwFace);
+}
+
+// Types text into a top-down 24-bit DIB section. Glyphs are rasterized through GDI once per font into a GlyphAtlas and
+// blended from there; an edit only lays out the text again and reports the bounds of the glyphs that moved or changed,
+// which the caller restores and hands back to Draw.
+class TextEngine {
+private:
+	static const DWORD dwPixelSize = 3;
+	PBYTE pBits;
+	DWORD dwScanLineSize;
+	SIZE bitmapSize;
+	GlyphPoint origin;
+	HDC hDC = NULL;
+	HFONT hFont = NULL, hFont_Old = NULL;
+	GlyphAtlas atlas;
+	GlyphAtlas::Page* pPage = NULL;
+	std::wstring text;
+	std::vector<PlacedGlyph> placedGlyphs;
+	std::vector<BYTE> colorSpan, alphaSpan, glyphCoverage;
+	std::atomic<ULONGLONG> ullHits { 0 }, ullMisses { 0 }, ullMissMicroseconds { 0 }, ullGlyphsDrawn { 0 }, ullDrawMicroseconds { 0 };
+
+	void AddGlyph(WCHAR wc) {
+		if (wc == L'\n')
+			return;
+		if (pPage->Find(wc)) {
+			ullHits++;
+			return;
+		}
+		LARGE_INTEGER startTime;
+		QueryPerformanceCounter(&startTime);
+		const MAT2 mat2 = { { 0, 1 }, { 0, 0 }, { 0, 0 }, { 0, 1 } };
+		GLYPHMETRICS glyphMetrics;
+		Glyph glyph = { 0 };
+		const DWORD dwSize = GetGlyphOutlineW(hDC, wc, GGO_GRAY8_BITMAP, &glyphMetrics, 0, NULL, &mat2);
+		if (dwSize != GDI_ERROR) {
+			glyph.lAdvance = glyphMetrics.gmCellIncX;
+			if (dwSize) {
+				std::vector<BYTE> buffer(dwSize);
+				GetGlyphOutlineW(hDC, wc, GGO_GRAY8_BITMAP, &glyphMetrics, dwSize, buffer.data(), &mat2);
+				// Rows are DWORD aligned with 65 levels of coverage
+				const DWORD dwStride = (glyphMetrics.gmBlackBoxX + 3) & ~3;
+				glyph.Origin = { glyphMetrics.gmptGlyphOrigin.x, -glyphMetrics.gmptGlyphOrigin.y };
+				glyph.Size = { (LONG)glyphMetrics.gmBlackBoxX, (LONG)min(glyphMetrics.gmBlackBoxY, dwSize / dwStride) };
+				glyphCoverage.resize((SIZE_T)glyph.Size.cx * glyph.Size.cy);
+				for (LONG y = 0; y < glyph.Size.cy; y++)
+					for (LONG x = 0; x < glyph.Size.cx; x++)
+						glyphCoverage[(SIZE_T)y * glyph.Size.cx + x] = (BYTE)((min(buffer[y * dwStride + x], (BYTE)64) * 0xff + 32) / 64);
+			}
+		}
+		pPage->Add(wc, glyph, glyphCoverage.data());
+		ullMisses++;
+		ullMissMicroseconds += GetElapsedMicroseconds(startTime.QuadPart);
+	}
+
+public:
+	~TextEngine() { End(); }
+
+	BOOL IsActive() const { return hDC != NULL; }
+
+	void Begin(PBYTE pBits, DWORD dwScanLineSize, SIZE bitmapSize, const TextFont& font, COLORREF color, POINT origin) {
+		End();
+		this->pBits = pBits;
+		this->dwScanLineSize = dwScanLineSize;
+		this->bitmapSize = bitmapSize;
+		this->origin = { origin.x, origin.y };
+		text.clear();
+		placedGlyphs.clear();
+		const SIZE_T uSpanSize = (SIZE_T)bitmapSize.cx * dwPixelSize;
+		alphaSpan.resize(uSpanSize);
+		colorSpan.resize(uSpanSize);
+		for (SIZE_T i = 0; i < uSpanSize; i += dwPixelSize) {
+			colorSpan[i] = GetBValue(color);
+			colorSpan[i + 1] = GetGValue(color);
+			colorSpan[i + 2] = GetRValue(color);
+		}
+		hDC = CreateCompatibleDC(NULL);
+		hFont = CreateTextFont(font);
+		hFont_Old = SelectFont(hDC, hFont);
+		atlas.Trim();
+		pPage = &atlas.GetPage(font.lpcwFace, font.lHeight, font.lWeight, font.bItalic != FALSE);
+		if (!pPage->bMetrics) {
+			TEXTMETRICW textMetric;
+			GetTextMetricsW(hDC, &textMetric);
+			pPage->lAscent = textMetric.tmAscent;
+			pPage->lLineHeight = textMetric.tmHeight;
+			pPage->bMetrics = true;
+		}
+	}
+
+	// Appends wc, or removes the last character if wc is '\b', and returns the area to restore and redraw
+	RECT Type(WCHAR wc) {
+		if (wc == L'\b') {
+			if (text.empty())
+				return { 0 };
+			text.pop_back();
+		}
+		else {
+			AddGlyph(wc);
+			text.push_back(wc);
+		}
+		std::vector<PlacedGlyph> previousGlyphs = std::move(placedGlyphs);
+		placedGlyphs = LayoutText(*pPage, text, origin);
+		size_t i = 0;
+		while (i < previousGlyphs.size() && i < placedGlyphs.size() && previousGlyphs[i].wc == placedGlyphs[i].wc &&
+			previousGlyphs[i].Pen.x == placedGlyphs[i].Pen.x && previousGlyphs[i].Pen.y == placedGlyphs[i].Pen.y)
+			i++;
+		GlyphRect rect = { 0 };
+		for (size_t j = i; j < previousGlyphs.size(); j++)
+			GlyphRect::Union(rect, previousGlyphs[j].Bounds);
+		for (size_t j = i; j < placedGlyphs.size(); j++)
+			GlyphRect::Union(rect, placedGlyphs[j].Bounds);
+		const GlyphRect bitmapRect = { 0, 0, bitmapSize.cx, bitmapSize.cy };
+		GlyphRect::Intersect(rect, rect, bitmapRect);
+		return { rect.left, rect.top, rect.right, rect.bottom };
+	}
+
+	// Blends every glyph, or the parts of them, inside rect; neighbors that overhang into rect are drawn again too
+	void Draw(const RECT& rect) {
+		LARGE_INTEGER startTime;
+		QueryPerformanceCounter(&startTime);
+		const GlyphRect clipRect = { rect.left, rect.top, rect.right, rect.bottom };
+		GlyphRect glyphRect;
+		for (const PlacedGlyph& placedGlyph : placedGlyphs)
+			if (GlyphRect::Intersect(glyphRect, placedGlyph.Bounds, clipRect)) {
+				BlendGlyph(pBits, dwScanLineSize, clipRect, *pPage, placedGlyph, colorSpan.data(), alphaSpan.data());
+				ullGlyphsDrawn++;
+			}
+		ullDrawMicroseconds += GetElapsedMicroseconds(startTime.QuadPart);
+	}
+
+	void End() {
+		if (!hDC)
+			return;
+		SelectFont(hDC, hFont_Old);
+		DeleteFont(hFont);
+		DeleteDC(hDC);
+		hDC = NULL;
+	}
+
+	TextStatistics GetStatistics() const { return { { ullHits, ullMisses, ullMissMicroseconds }, ullGlyphsDrawn, ullDrawMicroseconds }; }
+};
\ No newline at end of file
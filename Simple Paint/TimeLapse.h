@@ -0,0 +1,354 @@
+#pragma once
+
+#include <Windows.h>
+#include <Shlwapi.h>
+#include <Vfw.h>
+#include <atomic>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "OpLog.h"
+#include "Renderer.h"
+#include "resource.h"
+
+#pragma comment(lib, "Vfw32.lib")
+
+#define WM_TIMELAPSE_PROGRESS (WM_APP + 2) // wParam: frames written, lParam: frame count
+#define WM_TIMELAPSE_DONE (WM_APP + 3) // wParam: error code
+#define TIMELAPSE_DEFAULT_FRAME_RATE 30
+#define TIMELAPSE_DEFAULT_SPEED 10
+#define TIMELAPSE_MAX_FRAME_RATE 120
+#define TIMELAPSE_MAX_SPEED 1000
+#define TIMELAPSE_PROGRESS_INTERVAL 100 // milliseconds between progress notifications
+#define TIMELAPSE_MAX_FRAME_WIDTH 1920
+#define TIMELAPSE_MAX_FRAME_HEIGHT 1080
+
+enum class TimeLapseFormats { AVI, BitmapSequence };
+
+struct TimeLapseSettings {
+	UINT uFrameRate; // output frames per second
+	UINT uSpeed; // seconds of drawing shown per second of output
+};
+
+// lParam points to the TimeLapseSettings to edit, which are only updated when the dialog ends with IDOK
+INT_PTR CALLBACK DlgProc_TimeLapse(HWND hDlg, UINT uMsg, WPARAM wParam, LPARAM lParam) {
+	switch (uMsg) {
+	case WM_INITDIALOG: {
+		const TimeLapseSettings* pSettings = (const TimeLapseSettings*)lParam;
+		SetWindowLongPtrW(hDlg, DWLP_USER, lParam);
+		SetDlgItemInt(hDlg, IDC_FRAMERATE, pSettings->uFrameRate, FALSE);
+		SetDlgItemInt(hDlg, IDC_SPEED, pSettings->uSpeed, FALSE);
+	}	return TRUE;
+	case WM_COMMAND:
+		switch (LOWORD(wParam)) {
+		case IDOK: {
+			BOOL bFrameRateValid, bSpeedValid;
+			const UINT uFrameRate = GetDlgItemInt(hDlg, IDC_FRAMERATE, &bFrameRateValid, FALSE),
+				uSpeed = GetDlgItemInt(hDlg, IDC_SPEED, &bSpeedValid, FALSE);
+			const int iInvalidItem = !bFrameRateValid || !uFrameRate || uFrameRate > TIMELAPSE_MAX_FRAME_RATE ? IDC_FRAMERATE :
+				!bSpeedValid || !uSpeed || uSpeed > TIMELAPSE_MAX_SPEED ? IDC_SPEED : 0;
+			if (iInvalidItem) {
+				MessageBeep(MB_ICONWARNING);
+				SendDlgItemMessageW(hDlg, iInvalidItem, EM_SETSEL, 0, -1);
+				SetFocus(GetDlgItem(hDlg, iInvalidItem));
+				return TRUE;
+			}
+			*(TimeLapseSettings*)GetWindowLongPtrW(hDlg, DWLP_USER) = { uFrameRate, uSpeed };
+		}
+		case IDCANCEL: EndDialog(hDlg, LOWORD(wParam)); return TRUE;
+		}
+		break;
+	}
+	return FALSE;
+}
+
+// Replays an op log with a headless renderer on a worker thread and streams the canvas at a fixed frame rate into an
+// uncompressed AVI file or a numbered sequence of bitmap files. Each frame only renders the commands recorded since the
+// previous one and only scales the area they damaged into the frame buffer, which is at most
+// TIMELAPSE_MAX_FRAME_WIDTH by TIMELAPSE_MAX_FRAME_HEIGHT pixels however large the canvas is.
+// AVIFile writes AVI 1.0, which stops at about 2 GB; bitmap sequences have no such limit.
+class TimeLapseExporter {
+private:
+	HWND hWnd_Notify;
+	HANDLE hThread = NULL;
+	std::atomic<bool> bCancel { false };
+	OpLog opLog;
+	SIZE maxSize, sourceSize, frameSize; // frames show the top left sourceSize pixels of the canvas scaled down to frameSize
+	SIZE_T uMemoryBudget;
+	TimeLapseSettings settings;
+	TimeLapseFormats format;
+	std::wstring fileName; // without extension for bitmap sequences
+	DWORD dwFrameScanLineSize;
+	std::vector<BYTE> frame; // bottom-up 24-bit rows, as both formats store them
+	std::vector<LONG> sourceColumns; // frameSize.cx + 1 box edges
+	std::vector<UINT> sums; // of the channels of the source pixels in each box of a frame row
+	size_t uFramesWritten;
+	ULONGLONG ullElapsedMicroseconds;
+	PAVIFILE pAVIFile = NULL;
+	PAVISTREAM pAVIStream = NULL;
+	Renderer renderer; // headless
+
+	BITMAPINFOHEADER GetFrameHeader() const {
+		BITMAPINFOHEADER bitmapInfoHeader = { sizeof(bitmapInfoHeader) };
+		bitmapInfoHeader.biWidth = frameSize.cx;
+		bitmapInfoHeader.biHeight = frameSize.cy;
+		bitmapInfoHeader.biPlanes = 1;
+		bitmapInfoHeader.biBitCount = 24;
+		bitmapInfoHeader.biCompression = BI_RGB;
+		bitmapInfoHeader.biSizeImage = (DWORD)frame.size();
+		return bitmapInfoHeader;
+	}
+
+	// First source row of frame row y; frame column x starts at sourceColumns[x]
+	LONG GetSourceRow(LONG y) const { return (LONG)((LONGLONG)y * sourceSize.cy / frameSize.cy); }
+
+	// Averages each box of source pixels that overlaps rect of the canvas into its frame pixel; whatever lies outside the
+	// canvas is white. Boxes are a single pixel when the canvas fits the frame.
+	void UpdateFrame(const RECT& rect) {
+		const LazyBitmap& bitmap = renderer.GetBitmap();
+		const SIZE bitmapSize = renderer.GetBitmapSize();
+		const LONG lLeft = (LONG)((LONGLONG)rect.left * frameSize.cx / sourceSize.cx), lTop = (LONG)((LONGLONG)rect.top * frameSize.cy / sourceSize.cy),
+			lRight = (LONG)(((LONGLONG)rect.right * frameSize.cx + sourceSize.cx - 1) / sourceSize.cx), lBottom = (LONG)(((LONGLONG)rect.bottom * frameSize.cy + sourceSize.cy - 1) / sourceSize.cy);
+		for (LONG y = lTop; y < lBottom; y++) {
+			const LONG lSourceTop = GetSourceRow(y), lSourceBottom = GetSourceRow(y + 1);
+			sums.assign((size_t)(lRight - lLeft) * 3, 0);
+			for (LONG lSourceY = lSourceTop; lSourceY < lSourceBottom; lSourceY++) {
+				const BYTE* pSourceRow = bitmap.GetBits() + (SIZE_T)lSourceY * bitmap.GetScanLineSize();
+				const LONG lSourceRight = lSourceY < bitmapSize.cy && bitmap.IsMaterialized(lSourceY) ? bitmapSize.cx : 0;
+				UINT* pSums = sums.data();
+				for (LONG x = lLeft; x < lRight; x++, pSums += 3) {
+					const LONG lBoxLeft = sourceColumns[x], lBoxRight = sourceColumns[x + 1], lPixelRight = max(min(lBoxRight, lSourceRight), lBoxLeft);
+					const UINT uWhite = (UINT)(lBoxRight - lPixelRight) * 0xff;
+					UINT uBlue = uWhite, uGreen = uWhite, uRed = uWhite;
+					for (const BYTE* pSource = pSourceRow + (SIZE_T)lBoxLeft * 3, *pEnd = pSourceRow + (SIZE_T)lPixelRight * 3; pSource < pEnd; pSource += 3) {
+						uBlue += pSource[0];
+						uGreen += pSource[1];
+						uRed += pSource[2];
+					}
+					pSums[0] += uBlue;
+					pSums[1] += uGreen;
+					pSums[2] += uRed;
+				}
+			}
+			const PBYTE pRow = frame.data() + (frameSize.cy - 1 - y) * dwFrameScanLineSize;
+			const UINT* pSums = sums.data();
+			for (LONG x = lLeft; x < lRight; x++, pSums += 3) {
+				const UINT uArea = (UINT)((lSourceBottom - lSourceTop) * (sourceColumns[x + 1] - sourceColumns[x]));
+				for (int i = 0; i < 3; i++)
+					pRow[x * 3 + i] = (BYTE)((pSums[i] + uArea / 2) / uArea);
+			}
+		}
+	}
+
+	// Adds rect to rects, merged with every rect it overlaps, so that strokes far apart are not scaled into the frame as one
+	// rect spanning the canvas between them
+	static void AddDamage(std::vector<RECT>& rects, RECT rect) {
+		if (IsRectEmpty(&rect))
+			return;
+		for (size_t i = 0; i < rects.size();) {
+			RECT intersectionRect;
+			if (IntersectRect(&intersectionRect, &rects[i], &rect)) {
+				UnionRect(&rect, &rect, &rects[i]);
+				rects.erase(rects.begin() + i);
+				i = 0;
+			}
+			else
+				i++;
+		}
+		rects.push_back(rect);
+	}
+
+	// AVIFile returns HRESULTs, mostly AVIERR codes that FormatMessage does not know; maps them to the nearest Win32 error code
+	static DWORD GetAVIError(HRESULT hResult) {
+		if (SUCCEEDED(hResult))
+			return ERROR_SUCCESS;
+		if (HRESULT_FACILITY(hResult) == FACILITY_WIN32)
+			return HRESULT_CODE(hResult);
+		switch (hResult) {
+		case AVIERR_MEMORY: return ERROR_NOT_ENOUGH_MEMORY;
+		case AVIERR_FILEOPEN: return ERROR_OPEN_FAILED;
+		case AVIERR_FILEREAD: return ERROR_READ_FAULT;
+		case AVIERR_FILEWRITE: return ERROR_WRITE_FAULT;
+		case AVIERR_READONLY: return ERROR_ACCESS_DENIED;
+		case AVIERR_BADFORMAT: return ERROR_INVALID_DATA;
+		case AVIERR_BADFLAGS:
+		case AVIERR_BADPARAM:
+		case AVIERR_BADSIZE: return ERROR_INVALID_PARAMETER;
+		case AVIERR_UNSUPPORTED:
+		case AVIERR_NOCOMPRESSOR:
+		case AVIERR_COMPRESSOR: return ERROR_NOT_SUPPORTED;
+		case AVIERR_USERABORT: return ERROR_CANCELLED;
+		default: return ERROR_GEN_FAILURE;
+		}
+	}
+
+	DWORD OpenOutput() {
+		if (format != TimeLapseFormats::AVI)
+			return ERROR_SUCCESS;
+		AVIFileInit();
+		HRESULT hResult = AVIFileOpenW(&pAVIFile, fileName.c_str(), OF_CREATE | OF_WRITE, NULL);
+		if (SUCCEEDED(hResult)) {
+			AVISTREAMINFOW streamInfo = { streamtypeVIDEO, mmioFOURCC('D', 'I', 'B', ' ') };
+			streamInfo.dwScale = 1;
+			streamInfo.dwRate = settings.uFrameRate;
+			streamInfo.dwSuggestedBufferSize = (DWORD)frame.size();
+			SetRect(&streamInfo.rcFrame, 0, 0, frameSize.cx, frameSize.cy);
+			if (SUCCEEDED(hResult = AVIFileCreateStreamW(pAVIFile, &pAVIStream, &streamInfo))) {
+				BITMAPINFOHEADER bitmapInfoHeader = GetFrameHeader();
+				hResult = AVIStreamSetFormat(pAVIStream, 0, &bitmapInfoHeader, sizeof(bitmapInfoHeader));
+			}
+		}
+		return GetAVIError(hResult);
+	}
+
+	DWORD WriteFrame() {
+		if (format == TimeLapseFormats::AVI)
+			return GetAVIError(AVIStreamWrite(pAVIStream, (LONG)uFramesWritten, 1, frame.data(), (LONG)frame.size(), AVIIF_KEYFRAME, NULL, NULL));
+		WCHAR szSuffix[16];
+		swprintf_s(szSuffix, L"_%05u.bmp", (UINT)uFramesWritten + 1);
+		HANDLE hFile = CreateFileW((fileName + szSuffix).c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (hFile == INVALID_HANDLE_VALUE)
+			return GetLastError();
+		const BITMAPINFOHEADER bitmapInfoHeader = GetFrameHeader();
+		BITMAPFILEHEADER bitmapFileHeader = { 0 };
+		bitmapFileHeader.bfType = 0x4d42;
+		bitmapFileHeader.bfOffBits = sizeof(BITMAPFILEHEADER) + sizeof(BITMAPINFOHEADER);
+		bitmapFileHeader.bfSize = bitmapFileHeader.bfOffBits + bitmapInfoHeader.biSizeImage;
+		DWORD dwBytesWritten, dwLastError = ERROR_SUCCESS;
+		if (!WriteFile(hFile, &bitmapFileHeader, sizeof(bitmapFileHeader), &dwBytesWritten, NULL) ||
+			!WriteFile(hFile, &bitmapInfoHeader, sizeof(bitmapInfoHeader), &dwBytesWritten, NULL) ||
+			!WriteFile(hFile, frame.data(), (DWORD)frame.size(), &dwBytesWritten, NULL))
+			dwLastError = GetLastError();
+		CloseHandle(hFile);
+		return dwLastError;
+	}
+
+	void CloseOutput() {
+		if (format != TimeLapseFormats::AVI)
+			return;
+		if (pAVIStream)
+			AVIStreamRelease(pAVIStream);
+		if (pAVIFile)
+			AVIFileRelease(pAVIFile);
+		pAVIStream = NULL;
+		pAVIFile = NULL;
+		AVIFileExit();
+	}
+
+	DWORD Run() {
+		// Frame i shows the canvas as it was i * uSpeed / uFrameRate seconds into the drawing; the last frame shows the end of it
+		const size_t uFrameCount = (size_t)(opLog.GetDuration() * settings.uFrameRate / (1000ULL * settings.uSpeed)) + 1;
+		const RECT sourceRect = { 0, 0, sourceSize.cx, sourceSize.cy };
+		OpLog::Reader reader(opLog);
+		RenderCommand command;
+		std::vector<RECT> damageRects;
+		reader.Read(command); // the initial Clear, which only carries the starting size
+		DWORD dwError = renderer.StartHeadless(maxSize, command.Size, uMemoryBudget) ? OpenOutput() : GetLastError();
+		LARGE_INTEGER startTime;
+		QueryPerformanceCounter(&startTime);
+		ULONGLONG ullProgressTime = GetTickCount64();
+		while (dwError == ERROR_SUCCESS && uFramesWritten < uFrameCount && !bCancel) {
+			const ULONGLONG ullFrameTime = uFramesWritten * 1000ULL * settings.uSpeed / settings.uFrameRate;
+			const BOOL bLastFrame = uFramesWritten + 1 == uFrameCount;
+			const SIZE previousSize = renderer.GetBitmapSize();
+			damageRects.clear();
+			while (dwError == ERROR_SUCCESS && !reader.IsAtEnd() && (bLastFrame || reader.PeekTime() <= ullFrameTime)) {
+				reader.Read(command);
+				AddDamage(damageRects, renderer.Render(command));
+				dwError = renderer.PopError();
+			}
+			if (dwError != ERROR_SUCCESS)
+				break;
+			// A shrinking canvas leaves stale pixels in the area it gave up
+			const RECT previousRect = { 0, 0, previousSize.cx, previousSize.cy };
+			if (previousSize.cx != renderer.GetBitmapSize().cx || previousSize.cy != renderer.GetBitmapSize().cy)
+				AddDamage(damageRects, previousRect);
+			GdiFlush();
+			for (RECT& damageRect : damageRects)
+				if (IntersectRect(&damageRect, &damageRect, &sourceRect))
+					UpdateFrame(damageRect);
+			if ((dwError = WriteFrame()) == ERROR_SUCCESS)
+				uFramesWritten++;
+			if (GetTickCount64() - ullProgressTime >= TIMELAPSE_PROGRESS_INTERVAL) {
+				ullProgressTime = GetTickCount64();
+				PostMessageW(hWnd_Notify, WM_TIMELAPSE_PROGRESS, uFramesWritten, uFrameCount);
+			}
+		}
+		ullElapsedMicroseconds = GetElapsedMicroseconds(startTime.QuadPart);
+		CloseOutput();
+		renderer.Stop();
+		return dwError == ERROR_SUCCESS && bCancel ? ERROR_CANCELLED : dwError;
+	}
+
+	static DWORD WINAPI ThreadProc(LPVOID lpParameter) {
+		TimeLapseExporter* pExporter = (TimeLapseExporter*)lpParameter;
+		const DWORD dwError = pExporter->Run();
+		PostMessageW(pExporter->hWnd_Notify, WM_TIMELAPSE_DONE, dwError, 0);
+		return dwError;
+	}
+
+public:
+	// Exports opLog, recorded on a canvas of at most maxSize pixels, as frames that show the top left sourceSize pixels of
+	// it, scaled down with their aspect ratio kept if they do not fit TIMELAPSE_MAX_FRAME_WIDTH by TIMELAPSE_MAX_FRAME_HEIGHT.
+	// lpcwFileName is the AVI file, or the name the bitmap files are numbered after. Progress and completion are posted to
+	// hWnd_Notify, which must then call Finish. Returns FALSE with the last error set if the worker thread could not be started.
+	BOOL Start(HWND hWnd_Notify, const OpLog& opLog, SIZE maxSize, SIZE sourceSize, SIZE_T uMemoryBudget, const TimeLapseSettings& settings, LPCWSTR lpcwFileName, TimeLapseFormats format) {
+		this->hWnd_Notify = hWnd_Notify;
+		this->opLog = opLog;
+		this->maxSize = maxSize;
+		this->sourceSize = sourceSize;
+		if ((LONGLONG)sourceSize.cx * TIMELAPSE_MAX_FRAME_HEIGHT > (LONGLONG)sourceSize.cy * TIMELAPSE_MAX_FRAME_WIDTH) {
+			frameSize.cx = min(sourceSize.cx, TIMELAPSE_MAX_FRAME_WIDTH);
+			frameSize.cy = max((LONG)((LONGLONG)sourceSize.cy * frameSize.cx / sourceSize.cx), 1L);
+		}
+		else {
+			frameSize.cy = min(sourceSize.cy, TIMELAPSE_MAX_FRAME_HEIGHT);
+			frameSize.cx = max((LONG)((LONGLONG)sourceSize.cx * frameSize.cy / sourceSize.cy), 1L);
+		}
+		this->uMemoryBudget = uMemoryBudget;
+		this->settings = settings;
+		this->format = format;
+		WCHAR szFileName[MAX_PATH];
+		wcscpy_s(szFileName, lpcwFileName);
+		if (format == TimeLapseFormats::BitmapSequence)
+			PathRemoveExtensionW(szFileName);
+		fileName = szFileName;
+		dwFrameScanLineSize = (3 * frameSize.cx + 3) & ~3;
+		frame.assign((size_t)dwFrameScanLineSize * frameSize.cy, 0xff);
+		sourceColumns.resize(frameSize.cx + 1);
+		for (LONG x = 0; x <= frameSize.cx; x++)
+			sourceColumns[x] = (LONG)((LONGLONG)x * sourceSize.cx / frameSize.cx);
+		bCancel = false;
+		uFramesWritten = 0;
+		ullElapsedMicroseconds = 0;
+		hThread = CreateThread(NULL, 0, ThreadProc, this, 0, NULL);
+		return hThread != NULL;
+	}
+
+	BOOL IsRunning() const { return hThread != NULL; }
+
+	// Size of the frames of the last export started
+	SIZE GetFrameSize() const { return frameSize; }
+
+	// Waits for the export to end and returns its error code, ERROR_CANCELLED if it was cancelled;
+	// uFrameCount and fFramesPerSecond tell how many frames were written and how fast
+	DWORD Finish(size_t& uFrameCount, float& fFramesPerSecond) {
+		DWORD dwError = ERROR_SUCCESS;
+		if (hThread) {
+			WaitForSingleObject(hThread, INFINITE);
+			GetExitCodeThread(hThread, &dwError);
+			CloseHandle(hThread);
+			hThread = NULL;
+		}
+		uFrameCount = uFramesWritten;
+		fFramesPerSecond = uFramesWritten * 1000000.0f / max(ullElapsedMicroseconds, 1ULL);
+		return dwError;
+	}
+
+	void Cancel() {
+		size_t uFrameCount;
+		float fFramesPerSecond;
+		bCancel = true;
+		Finish(uFrameCount, fFramesPerSecond);
+	}
+};
\ No newline at end of file
@@ -3,10 +3,12 @@
 #include <Windows.h>
 #include <Shlwapi.h>
 #include <CommCtrl.h>
+#include <Psapi.h>
 #include <windowsx.h>
 #include "SysErrorMsg.h"
 
 #pragma comment(lib, "Shlwapi.lib")
+#pragma comment(lib, "Psapi.lib")
 
 #pragma comment(linker, "/SUBSYSTEM:WINDOWS")
 
@@ -29,12 +31,35 @@
 
 #define SYS_WHITE_BRUSH (HBRUSH)(COLOR_WINDOW + 1)
 
+#pragma region Distinguish pen and touch input from mouse input
+#define MI_WP_SIGNATURE 0xff515700
+#define MI_WP_SIGNATURE_MASK 0xffffff00
+#pragma endregion
+
+#pragma region Trace startup time and memory usage
+// Milliseconds since the process was created
+ULONGLONG GetProcessUptime() {
+	FILETIME creationTime, exitTime, kernelTime, userTime, currentTime;
+	if (!GetProcessTimes(GetCurrentProcess(), &creationTime, &exitTime, &kernelTime, &userTime))
+		return 0;
+	GetSystemTimeAsFileTime(&currentTime);
+	const ULARGE_INTEGER creation = { creationTime.dwLowDateTime, creationTime.dwHighDateTime }, current = { currentTime.dwLowDateTime, currentTime.dwHighDateTime };
+	return (current.QuadPart - creation.QuadPart) / 10000;
+}
+
+SIZE_T GetWorkingSetSize() {
+	PROCESS_MEMORY_COUNTERS processMemoryCounters;
+	return GetProcessMemoryInfo(GetCurrentProcess(), &processMemoryCounters, sizeof(processMemoryCounters)) ? processMemoryCounters.WorkingSetSize : 0;
+}
+#pragma endregion
+
 #pragma region Support high DPI displays
 #define Scale(iPixels, iDPI) MulDiv(iPixels, iDPI, USER_DEFAULT_SCREEN_DPI)
 #define DPIAware_CreateWindowExW(iDPI, dwExStyle, lpClassName, lpWindowName, dwStyle, iX, iY, nWidth, nHeight, hWndParent, hMenu, hInstance, lpParam) CreateWindowExW(dwExStyle, lpClassName, lpWindowName, dwStyle, Scale(iX, iDPI), Scale(iY, iDPI), Scale(nWidth, iDPI), Scale(nHeight, iDPI), hWndParent, hMenu, hInstance, lpParam)
 #pragma endregion
 
-BOOL SaveDCAs24bitBitmapFile(LPCWSTR lpcwFileName, HDC hDC, UINT uWidth, UINT uHeight)
+// copyProc draws rect of the image to (iX, iY) of hDC_Target
+BOOL SaveAs24bitBitmapFile(LPCWSTR lpcwFileName, void (*copyProc)(HDC hDC_Target, int iX, int iY, const RECT& rect), UINT uWidth, UINT uHeight)
 {
 	HANDLE hFile = CreateFileW(lpcwFileName, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
 	if (hFile == INVALID_HANDLE_VALUE)
@@ -53,7 +78,8 @@ BOOL SaveDCAs24bitBitmapFile(LPCWSTR lpcwFileName, HDC hDC, UINT uWidth, UINT uH
 	if (hBitmap == NULL)
 		return FALSE;
 	HBITMAP hBitmap_Old = SelectBitmap(hDC_Memory, hBitmap);
-	BitBlt(hDC_Memory, 0, 0, uWidth, uHeight, hDC, 0, 0, SRCCOPY);
+	const RECT rect = { 0, 0, (LONG)uWidth, (LONG)uHeight };
+	copyProc(hDC_Memory, 0, 0, rect);
 	BITMAPFILEHEADER bitmapFileHeader = { 0 };
 	bitmapFileHeader.bfType = 0x4d42;
 	bitmapFileHeader.bfOffBits = sizeof(BITMAPFILEHEADER) + sizeof(BITMAPINFOHEADER);
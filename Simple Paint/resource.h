@@ -6,7 +6,13 @@
 #define IDD_DIALOG_ABOUT                102
 #define IDR_ACCELERATOR                 103
 #define IDC_SYSLINK                     104
+#define IDD_DIALOG_TIMELAPSE            107
+#define IDD_DIALOG_DIAGNOSTICS          108
 #define ID_CANVAS                       111
+#define ID_HISTORY                      112
+#define IDC_FRAMERATE                   1002
+#define IDC_SPEED                       1003
+#define IDC_DIAGNOSTICS                 1004
 #define IDM_NEW                         40001
 #define IDA_NEW                         40001
 #define IDM_NEWWINDOW                   40002
@@ -24,25 +30,52 @@
 #define IDM_PEN                         40009
 #define IDM_ERASER                      40010
 #define IDM_FILL                        40011
-#define IDM_COLORPICKER                 40012
-#define IDM_PENSIZE_1PX                 40013
-#define IDM_PENSIZE_2PX                 40014
-#define IDM_PENSIZE_4PX                 40015
-#define IDM_PENSIZE_8PX                 40016
-#define IDM_ERASERSIZE_1PX              40017
-#define IDM_ERASERSIZE_2PX              40018
-#define IDM_ERASERSIZE_4PX              40019
-#define IDM_ERASERSIZE_8PX              40020
-#define IDM_COLOR                       40021
-#define IDM_ABOUT                       40022
+#define IDM_LINE                        40012
+#define IDM_RECTANGLE                   40013
+#define IDM_ELLIPSE                     40014
+#define IDM_TEXT                        40015
+#define IDM_COLORPICKER                 40016
+#define IDM_PENSIZE_1PX                 40017
+#define IDM_PENSIZE_2PX                 40018
+#define IDM_PENSIZE_4PX                 40019
+#define IDM_PENSIZE_8PX                 40020
+#define IDM_PENSIZE_16PX                40021
+#define IDM_PENSIZE_32PX                40022
+#define IDM_PENSIZE_64PX                40023
+#define IDM_PENSIZE_128PX               40024
+#define IDM_PENSIZE_256PX               40025
+#define IDM_ERASERSIZE_1PX              40026
+#define IDM_ERASERSIZE_2PX              40027
+#define IDM_ERASERSIZE_4PX              40028
+#define IDM_ERASERSIZE_8PX              40029
+#define IDM_ERASERSIZE_16PX             40030
+#define IDM_ERASERSIZE_32PX             40031
+#define IDM_ERASERSIZE_64PX             40032
+#define IDM_ERASERSIZE_128PX            40033
+#define IDM_ERASERSIZE_256PX            40034
+#define IDM_BRUSHHARDNESS_HARD          40035
+#define IDM_BRUSHHARDNESS_MEDIUM        40036
+#define IDM_BRUSHHARDNESS_SOFT          40037
+#define IDM_BRUSHSPACING_5              40038
+#define IDM_BRUSHSPACING_10             40039
+#define IDM_BRUSHSPACING_25             40040
+#define IDM_BRUSHSPACING_50             40041
+#define IDM_SHAPESTYLE_OUTLINE          40042
+#define IDM_SHAPESTYLE_FILLED           40043
+#define IDM_COLOR                       40044
+#define IDM_ABOUT                       40045
+#define IDM_EXPORTTIMELAPSE             40070
+#define IDM_SHAREDCANVAS                40071
+#define IDM_FONT                        40073
+#define IDM_DIAGNOSTICS                 40074
 
 // Next default values for new objects
 // 
 #ifdef APSTUDIO_INVOKED
 #ifndef APSTUDIO_READONLY_SYMBOLS
-#define _APS_NEXT_RESOURCE_VALUE        107
-#define _APS_NEXT_COMMAND_VALUE         40070
-#define _APS_NEXT_CONTROL_VALUE         1002
+#define _APS_NEXT_RESOURCE_VALUE        109
+#define _APS_NEXT_COMMAND_VALUE         40075
+#define _APS_NEXT_CONTROL_VALUE         1005
 #define _APS_NEXT_SYMED_VALUE           101
 #endif
 #endif
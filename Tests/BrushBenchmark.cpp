@@ -0,0 +1,47 @@
+/*
+Stamps BrushEngine strokes into a heap buffer at brush sizes from 1 to 256 pixels and reports dab throughput. Needs no
+Windows headers.
+Build from a Developer Command Prompt: cl /nologo /O2 /EHsc /std:c++14 /I"..\Simple Paint" BrushBenchmark.cpp
+*/
+
+#include <chrono>
+#include <cstdio>
+#include <vector>
+#include "BrushEngine.h"
+
+#define BENCHMARK_CANVAS_SIZE 1024
+#define BENCHMARK_SPACING 0.1f
+#define BENCHMARK_DURATION 250 // milliseconds per brush size
+
+double GetSeconds() { return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count(); }
+
+int main() {
+	const BrushSize bitmapSize = { BENCHMARK_CANVAS_SIZE, BENCHMARK_CANVAS_SIZE };
+	const uint32_t dwScanLineSize = (bitmapSize.cx * 3 + 3) & ~3;
+	std::vector<uint8_t> bits((size_t)dwScanLineSize * bitmapSize.cy, 0xff);
+	printf("%8s %14s %12s %14s\n", "size", "dabs/s", "ns/dab", "Mpixels/s");
+	for (float fDiameter = 1; fDiameter <= 256; fDiameter *= 2) {
+		BrushEngine brushEngine;
+		// Dabs are spaced evenly at constant pressure, so a stroke of a given length always makes the same number of them
+		const float fMargin = fDiameter / 2, fLength = BENCHMARK_CANVAS_SIZE - 2 * fMargin,
+			fDabSpacing = (std::max)(fDiameter * BENCHMARK_SPACING, BRUSH_MIN_SPACING);
+		unsigned long long ullDabs = 0;
+		double dSeconds = 0;
+		for (bool bWarm = false; dSeconds * 1000 < BENCHMARK_DURATION; bWarm = true) {
+			const double dStart = GetSeconds();
+			brushEngine.BeginStroke(bits.data(), dwScanLineSize, bitmapSize, 0x804020, fDiameter, 0x80, BENCHMARK_SPACING, fMargin, fMargin, 1);
+			for (float fY = fMargin; fY < fMargin + fLength; fY += fDiameter) {
+				brushEngine.StrokeTo(fMargin + fLength, fY, 1);
+				brushEngine.StrokeTo(fMargin, fY + fDiameter / 2, 1);
+			}
+			// The first stroke fills the stamp cache and is not counted
+			if (bWarm) {
+				dSeconds += GetSeconds() - dStart;
+				for (float fY = fMargin; fY < fMargin + fLength; fY += fDiameter)
+					ullDabs += (unsigned long long)(2 * sqrtf(fLength * fLength + fDiameter * fDiameter / 4) / fDabSpacing);
+			}
+		}
+		printf("%8.0f %14.0f %12.1f %14.1f\n", fDiameter, ullDabs / dSeconds, dSeconds * 1e9 / ullDabs, ullDabs * (double)(fDiameter + 1) * (fDiameter + 1) / dSeconds / 1e6);
+	}
+	return 0;
+}
\ No newline at end of file
@@ -0,0 +1,104 @@
+/*
+Drags line, rectangle and ellipse previews through a 1920x1080 view of canvases from 1024x1024 up to the largest canvas
+size and reports the mean and worst preview frame time of each; frames should cost the same at every canvas size.
+Build from a Developer Command Prompt: cl /nologo /O2 /EHsc /std:c++14 /I"..\Simple Paint" FrameTimeBenchmark.cpp user32.lib gdi32.lib
+*/
+
+#include <Windows.h>
+#include <cstdio>
+#include <cstdlib>
+#include "Renderer.h"
+
+#define BENCHMARK_VIEW_WIDTH 1920
+#define BENCHMARK_VIEW_HEIGHT 1080
+#define BENCHMARK_MEMORY_BUDGET (512 << 20)
+#define BENCHMARK_STROKES 64
+#define BENCHMARK_FRAMES 256
+
+#ifdef _WIN64
+#define BENCHMARK_CANVAS_MAX 24576
+#else
+#define BENCHMARK_CANVAS_MAX 8192
+#endif
+
+const Renderer* pRenderer;
+
+void CopyCanvas(HDC hDC_Target, int iX, int iY, const RECT& rect) { pRenderer->Copy(hDC_Target, iX, iY, rect); }
+
+LONGLONG GetTime() {
+	LARGE_INTEGER counter;
+	QueryPerformanceCounter(&counter);
+	return counter.QuadPart;
+}
+
+int main() {
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+	HDC hDC_Screen = GetDC(NULL), hDC_View = CreateCompatibleDC(hDC_Screen);
+	HBITMAP hBitmap_Old = SelectBitmap(hDC_View, CreateCompatibleBitmap(hDC_Screen, BENCHMARK_VIEW_WIDTH, BENCHMARK_VIEW_HEIGHT));
+	ReleaseDC(NULL, hDC_Screen);
+	printf("%12s %10s %10s %10s\n", "canvas", "shape", "mean us", "max us");
+	for (LONG lSize = 1024; lSize <= BENCHMARK_CANVAS_MAX; lSize = lSize < 16384 ? lSize * 2 : BENCHMARK_CANVAS_MAX) {
+		const SIZE size = { lSize, lSize };
+		Renderer renderer;
+		if (!renderer.Start(NULL, size, size, BENCHMARK_MEMORY_BUDGET)) {
+			printf("Failed to create a %ldx%ld canvas: error %lu\n", size.cx, size.cy, GetLastError());
+			return 1;
+		}
+		pRenderer = &renderer;
+		// The view is scrolled to the middle of the canvas, like a window showing part of a large canvas
+		const RECT viewRect = { (lSize - min(lSize, BENCHMARK_VIEW_WIDTH)) / 2, (lSize - min(lSize, BENCHMARK_VIEW_HEIGHT)) / 2, (lSize + min(lSize, BENCHMARK_VIEW_WIDTH)) / 2, (lSize + min(lSize, BENCHMARK_VIEW_HEIGHT)) / 2 };
+		srand(1);
+		for (int i = 0; i < BENCHMARK_STROKES; i++) {
+			RenderCommand command = { RenderCommandTypes::BeginStroke };
+			command.Color = RGB(rand() & 0xff, rand() & 0xff, rand() & 0xff);
+			command.bHardness = 0x80;
+			command.fX = (float)(viewRect.left + rand() % (viewRect.right - viewRect.left));
+			command.fY = (float)(viewRect.top + rand() % (viewRect.bottom - viewRect.top));
+			command.fPressure = 1;
+			command.fDiameter = 16;
+			command.fSpacing = 0.1f;
+			renderer.Submit(command);
+			command.Type = RenderCommandTypes::StrokeTo;
+			command.fX = (float)(viewRect.left + rand() % (viewRect.right - viewRect.left));
+			renderer.Submit(command);
+			const RenderCommand commit = { RenderCommandTypes::Commit, 0, L"Pen" };
+			renderer.Submit(commit);
+		}
+		renderer.Flush();
+		RECT damageRect;
+		SIZE bitmapSize;
+		LONGLONG llInputTime, llJumpTime;
+		renderer.PopPresentItems(damageRect, bitmapSize, llInputTime, llJumpTime);
+		SetViewportOrgEx(hDC_View, -viewRect.left, -viewRect.top, NULL);
+		renderer.Copy(hDC_View, viewRect.left, viewRect.top, viewRect);
+		const struct {
+			ShapeTypes Type;
+			LPCSTR lpszName;
+		} shapeTypes[] = { { ShapeTypes::Line, "line" }, { ShapeTypes::Rectangle, "rectangle" }, { ShapeTypes::Ellipse, "ellipse" } };
+		for (const auto& shapeType : shapeTypes) {
+			// Drags from the middle of the view towards its bottom right corner, one mouse move per frame
+			Shape shape = { shapeType.Type, { (viewRect.left + viewRect.right) / 2, (viewRect.top + viewRect.bottom) / 2 }, { 0 }, RGB(0x20, 0x40, 0x80), 4, FALSE };
+			ShapeOverlay shapeOverlay;
+			LONGLONG llTotalTicks = 0, llMaxTicks = 0;
+			for (int i = 1; i <= BENCHMARK_FRAMES; i++) {
+				shape.To = { shape.From.x + (viewRect.right - shape.From.x - 1) * i / BENCHMARK_FRAMES, shape.From.y + (viewRect.bottom - shape.From.y - 1) * i / BENCHMARK_FRAMES };
+				const LONGLONG llStart = GetTime();
+				shapeOverlay.Show(hDC_View, CopyCanvas, viewRect, shape);
+				GdiFlush();
+				const LONGLONG llTicks = GetTime() - llStart;
+				llTotalTicks += llTicks;
+				llMaxTicks = max(llMaxTicks, llTicks);
+			}
+			shapeOverlay.Hide(hDC_View, CopyCanvas);
+			printf("%5ldx%-6ld %10s %10.0f %10.0f\n", size.cx, size.cy, shapeType.lpszName, llTotalTicks * 1e6 / frequency.QuadPart / BENCHMARK_FRAMES, llMaxTicks * 1e6 / frequency.QuadPart);
+		}
+		SetViewportOrgEx(hDC_View, 0, 0, NULL);
+		renderer.Stop();
+		if (lSize == BENCHMARK_CANVAS_MAX)
+			break;
+	}
+	DeleteBitmap(SelectBitmap(hDC_View, hBitmap_Old));
+	DeleteDC(hDC_View);
+	return 0;
+}
\ No newline at end of file
@@ -0,0 +1,82 @@
+/*
+Draws random strokes on a headless renderer and reports how long history jumps take back and forth over distances from
+1 to 512 states, and to random states.
+Build from a Developer Command Prompt: cl /nologo /O2 /EHsc /std:c++14 /I"..\Simple Paint" HistoryBenchmark.cpp user32.lib gdi32.lib
+*/
+
+#include <Windows.h>
+#include <cstdio>
+#include <cstdlib>
+#include "Renderer.h"
+
+#define BENCHMARK_CANVAS_WIDTH 1920
+#define BENCHMARK_CANVAS_HEIGHT 1080
+#define BENCHMARK_MEMORY_BUDGET (512 << 20)
+#define BENCHMARK_STROKES 512
+#define BENCHMARK_STROKE_POINTS 32
+#define BENCHMARK_JUMPS 256
+
+LONGLONG GetTime() {
+	LARGE_INTEGER counter;
+	QueryPerformanceCounter(&counter);
+	return counter.QuadPart;
+}
+
+// Jumps to the targets that nextTarget returns and prints the mean and the worst time of a jump
+template <class NextTarget>
+void MeasureJumps(Renderer& renderer, LPCSTR lpszName, NextTarget nextTarget) {
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+	LONGLONG llTotalTicks = 0, llMaxTicks = 0;
+	for (int i = 0; i < BENCHMARK_JUMPS; i++) {
+		RenderCommand command = { RenderCommandTypes::Jump };
+		command.uTarget = nextTarget(i);
+		const LONGLONG llStart = GetTime();
+		renderer.Render(command);
+		const LONGLONG llTicks = GetTime() - llStart;
+		llTotalTicks += llTicks;
+		llMaxTicks = max(llMaxTicks, llTicks);
+	}
+	printf("%-14s %10.0f %10.0f\n", lpszName, llTotalTicks * 1e6 / frequency.QuadPart / BENCHMARK_JUMPS, llMaxTicks * 1e6 / frequency.QuadPart);
+}
+
+int main() {
+	const SIZE size = { BENCHMARK_CANVAS_WIDTH, BENCHMARK_CANVAS_HEIGHT };
+	Renderer renderer;
+	if (!renderer.StartHeadless(size, size, BENCHMARK_MEMORY_BUDGET)) {
+		printf("Failed to create the canvas: error %lu\n", GetLastError());
+		return 1;
+	}
+	srand(1);
+	for (int i = 0; i < BENCHMARK_STROKES; i++) {
+		RenderCommand command = { RenderCommandTypes::BeginStroke };
+		command.Color = RGB(rand() & 0xff, rand() & 0xff, rand() & 0xff);
+		command.bHardness = (BYTE)(rand() & 0xff);
+		command.fX = (float)(rand() % size.cx);
+		command.fY = (float)(rand() % size.cy);
+		command.fPressure = 1;
+		command.fDiameter = (float)(1 + rand() % 64);
+		command.fSpacing = 0.1f;
+		renderer.Render(command);
+		command.Type = RenderCommandTypes::StrokeTo;
+		for (int j = 0; j < BENCHMARK_STROKE_POINTS; j++) {
+			command.fX = min(max(command.fX + rand() % 129 - 64, 0.0f), (float)size.cx);
+			command.fY = min(max(command.fY + rand() % 129 - 64, 0.0f), (float)size.cy);
+			command.fPressure = (1 + rand() % 100) / 100.0f;
+			renderer.Render(command);
+		}
+		const RenderCommand commit = { RenderCommandTypes::Commit, 0, L"Pen" };
+		renderer.Render(commit);
+	}
+	printf("%d strokes on a %ldx%ld canvas\n%-14s %10s %10s\n", BENCHMARK_STROKES, size.cx, size.cy, "jump", "mean us", "max us");
+	// Alternates between the latest state and the one uDistance states before it
+	const size_t distances[] = { 1, 16, 64, 256, 512 };
+	for (const size_t uDistance : distances) {
+		char szName[16];
+		snprintf(szName, sizeof(szName), "distance %zu", uDistance);
+		MeasureJumps(renderer, szName, [uDistance](int i) { return (size_t)(i % 2 ? BENCHMARK_STROKES : BENCHMARK_STROKES - uDistance); });
+	}
+	MeasureJumps(renderer, "random", [](int) { return (size_t)(rand() % (BENCHMARK_STROKES + 1)); });
+	renderer.Stop();
+	return 0;
+}
\ No newline at end of file
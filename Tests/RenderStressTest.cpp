@@ -0,0 +1,182 @@
+/*
+Checks that SPSCQueue hands items from one thread to another in order, then drives a render thread with random strokes,
+fills, shapes, resizes and history jumps and checks that replaying its op log on a headless renderer gives the same pixels.
+Build from a Developer Command Prompt: cl /nologo /O2 /EHsc /std:c++14 /I"..\Simple Paint" RenderStressTest.cpp user32.lib gdi32.lib
+*/
+
+#include <Windows.h>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include "Renderer.h"
+#include "SPSCQueue.h"
+
+#define TEST_QUEUE_ITEMS 10000000ULL
+#define TEST_OPERATIONS 2000
+#define TEST_MEMORY_BUDGET (1 << 20) // small enough for canvas bands and history payloads to spill
+
+struct QueueItem {
+	ULONGLONG ullSequence, ullCheck;
+};
+
+SPSCQueue<QueueItem, 1024> queue;
+
+DWORD WINAPI ProducerProc(LPVOID) {
+	for (ULONGLONG i = 0; i < TEST_QUEUE_ITEMS; i++) {
+		const QueueItem item = { i, ~i * 0x9e3779b97f4a7c15ULL };
+		while (!queue.TryPush(item))
+			SwitchToThread();
+	}
+	return 0;
+}
+
+BOOL TestQueue() {
+	LARGE_INTEGER frequency, startTime, endTime;
+	QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&startTime);
+	HANDLE hThread = CreateThread(NULL, 0, ProducerProc, NULL, 0, NULL);
+	ULONGLONG ullExpected = 0, ullErrors = 0;
+	while (ullExpected < TEST_QUEUE_ITEMS) {
+		QueueItem item;
+		if (!queue.TryPop(item)) {
+			SwitchToThread();
+			continue;
+		}
+		ullErrors += item.ullSequence != ullExpected || item.ullCheck != ~ullExpected * 0x9e3779b97f4a7c15ULL;
+		ullExpected = item.ullSequence + 1;
+	}
+	WaitForSingleObject(hThread, INFINITE);
+	CloseHandle(hThread);
+	QueryPerformanceCounter(&endTime);
+	printf("SPSCQueue: %llu items, %llu out of order or torn, %.0f items/s\n", TEST_QUEUE_ITEMS, ullErrors,
+		TEST_QUEUE_ITEMS * (double)frequency.QuadPart / (endTime.QuadPart - startTime.QuadPart));
+	return !ullErrors && queue.IsEmpty();
+}
+
+// Rows whose pixels differ between the canvases of two flushed renderers, reading unwritten bands as white
+LONG CompareCanvases(const Renderer& renderer1, const Renderer& renderer2) {
+	const SIZE size = renderer1.GetBitmapSize(), size2 = renderer2.GetBitmapSize();
+	if (size.cx != size2.cx || size.cy != size2.cy)
+		return max(size.cy, size2.cy);
+	const LazyBitmap& bitmap1 = renderer1.GetBitmap(), & bitmap2 = renderer2.GetBitmap();
+	const std::vector<BYTE> white((SIZE_T)size.cx * 3, 0xff);
+	LONG lDifferentRows = 0;
+	for (LONG y = 0; y < size.cy; y++) {
+		LPCBYTE pRow1 = bitmap1.IsMaterialized(y) ? bitmap1.GetBits() + y * bitmap1.GetScanLineSize() : white.data(),
+			pRow2 = bitmap2.IsMaterialized(y) ? bitmap2.GetBits() + y * bitmap2.GetScanLineSize() : white.data();
+		lDifferentRows += memcmp(pRow1, pRow2, white.size()) != 0;
+	}
+	return lDifferentRows;
+}
+
+// Coordinates on half pixels and pressures in 1/1024 steps, which the op log stores exactly
+float RandomCoordinate(LONG lExtent) { return (rand() % (2 * lExtent)) / 2.0f; }
+
+float RandomPressure() { return (1 + rand() % 1024) / 1024.0f; }
+
+BOOL TestRenderer() {
+	const SIZE maxSize = { 640, 480 }, size = { 512, 384 };
+	Renderer renderer, replay;
+	if (!renderer.Start(NULL, maxSize, size, TEST_MEMORY_BUDGET) || !replay.StartHeadless(maxSize, size, TEST_MEMORY_BUDGET)) {
+		printf("Failed to create a canvas: error %lu\n", GetLastError());
+		return FALSE;
+	}
+	srand(1);
+	SIZE bitmapSize = size; // as last resized; jumps may change it, which only moves some operations off the canvas
+	size_t uCount = 0, uPosition = 0;
+	for (int i = 0; i < TEST_OPERATIONS; i++) {
+		const int iAction = rand() % 100;
+		RenderCommand command = { RenderCommandTypes::BeginStroke };
+		if (iAction < 60) {
+			command.Color = RGB(rand() & 0xff, rand() & 0xff, rand() & 0xff);
+			command.bHardness = (BYTE)(rand() & 0xff);
+			command.fX = RandomCoordinate(bitmapSize.cx);
+			command.fY = RandomCoordinate(bitmapSize.cy);
+			command.fPressure = RandomPressure();
+			command.fDiameter = (float)(1 + rand() % 48);
+			command.fSpacing = 0.1f;
+			renderer.Submit(command);
+			command.Type = RenderCommandTypes::StrokeTo;
+			for (int j = rand() % 40; j; j--) {
+				command.fX = RandomCoordinate(bitmapSize.cx);
+				command.fY = RandomCoordinate(bitmapSize.cy);
+				command.fPressure = RandomPressure();
+				renderer.Submit(command);
+			}
+		}
+		else if (iAction < 65) {
+			command.Type = RenderCommandTypes::Fill;
+			command.Color = RGB(rand() & 0xff, rand() & 0xff, rand() & 0xff);
+			command.fX = (float)(rand() % bitmapSize.cx);
+			command.fY = (float)(rand() % bitmapSize.cy);
+			renderer.Submit(command);
+		}
+		else if (iAction < 75) {
+			command.Type = RenderCommandTypes::DrawShape;
+			command.lpcwName = L"Shape";
+			command.DrawnShape.Type = (ShapeTypes)(rand() % 3);
+			command.DrawnShape.From = { rand() % bitmapSize.cx, rand() % bitmapSize.cy };
+			command.DrawnShape.To = { rand() % bitmapSize.cx, rand() % bitmapSize.cy };
+			command.DrawnShape.Color = RGB(rand() & 0xff, rand() & 0xff, rand() & 0xff);
+			command.DrawnShape.iWidth = 1 + rand() % 8;
+			command.DrawnShape.bFilled = rand() % 2;
+			renderer.Submit(command);
+			uCount = ++uPosition;
+		}
+		else if (iAction < 85) {
+			command.Type = RenderCommandTypes::Jump;
+			command.uTarget = rand() % (uCount + 1);
+			renderer.Submit(command);
+			uPosition = command.uTarget;
+		}
+		else if (iAction < 90) {
+			command.Type = RenderCommandTypes::Resize;
+			command.Size = bitmapSize = { 64 + rand() % (maxSize.cx - 63), 64 + rand() % (maxSize.cy - 63) };
+			renderer.Submit(command);
+			uCount = ++uPosition;
+		}
+		if (iAction < 65) {
+			// Strokes and fills are pending until committed, and some are cancelled instead
+			const BOOL bCancel = rand() % 10 == 0;
+			const RenderCommand end = { bCancel ? RenderCommandTypes::Cancel : RenderCommandTypes::Commit, 0, L"Pen" };
+			renderer.Submit(end);
+			if (!bCancel)
+				uCount = ++uPosition;
+		}
+		// The UI thread's side of the present queue
+		RECT damageRect;
+		SIZE presentSize;
+		LONGLONG llInputTime, llJumpTime;
+		renderer.PopPresentItems(damageRect, presentSize, llInputTime, llJumpTime);
+	}
+	renderer.Flush();
+	const OpLog opLog = renderer.GetOpLog();
+	OpLog::Reader reader(opLog);
+	RenderCommand command;
+	while (reader.Read(command))
+		replay.Render(command);
+	LONG lDifferentRows = CompareCanvases(renderer, replay);
+	// Both histories must also agree on every state they can go back to
+	for (const size_t uTarget : { (size_t)0, uCount / 2, uCount }) {
+		RenderCommand jump = { RenderCommandTypes::Jump };
+		jump.uTarget = uTarget;
+		renderer.Submit(jump);
+		renderer.Flush();
+		replay.Render(jump);
+		lDifferentRows += CompareCanvases(renderer, replay);
+	}
+	CacheStatistics canvasStatistics, historyStatistics;
+	renderer.GetStatistics(canvasStatistics, historyStatistics);
+	printf("Renderer: %d operations, %zu history entries, %zu op log bytes, %ld rows differ from the replay and its history; "
+		"canvas cache %llu hits, %llu misses; history cache %llu hits, %llu misses\n", TEST_OPERATIONS, uCount, opLog.GetSize(), lDifferentRows,
+		canvasStatistics.ullHits, canvasStatistics.ullMisses, historyStatistics.ullHits, historyStatistics.ullMisses);
+	renderer.Stop();
+	replay.Stop();
+	return !lDifferentRows;
+}
+
+int main() {
+	const BOOL bQueuePassed = TestQueue(), bRendererPassed = TestRenderer();
+	printf(bQueuePassed && bRendererPassed ? "PASSED\n" : "FAILED\n");
+	return bQueuePassed && bRendererPassed ? 0 : 1;
+}
\ No newline at end of file
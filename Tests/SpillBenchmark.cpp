@@ -0,0 +1,94 @@
+/*
+Writes to a lazily committed canvas of about 500 megapixels, mapped from a sparse scratch file like the renderer's, and
+reads history-like payloads back from a SpillCache, both under a 512 MB budget split between them as the renderer
+splits it. Reports the hit rate and the mean page-in or read-back latency of misses for sequential, local and random use.
+Needs a 64-bit build to map the canvas.
+Build from a Developer Command Prompt: cl /nologo /O2 /EHsc /std:c++14 /I"..\Simple Paint" SpillBenchmark.cpp
+*/
+
+#include <Windows.h>
+#include <cstdio>
+#include <cstdlib>
+#include "LazyBitmap.h"
+#include "SpillCache.h"
+
+#define BENCHMARK_CANVAS_WIDTH 24576
+#define BENCHMARK_CANVAS_HEIGHT 20480 // 503 megapixels
+#define BENCHMARK_MEMORY_BUDGET (512 << 20)
+#define BENCHMARK_BAND_WRITES 16384
+#define BENCHMARK_PAYLOAD_SIZE (256 << 10)
+#define BENCHMARK_PAYLOADS 4096 // 1 GB
+#define BENCHMARK_PAYLOAD_READS 4096
+
+size_t GetRandom(size_t uCount) { return ((size_t)rand() * ((size_t)RAND_MAX + 1) + rand()) % uCount; }
+
+// Prints the hits and misses counted since previous and makes current the next previous
+void PrintStatistics(LPCSTR lpszName, ULONGLONG ullAccesses, const CacheStatistics& current, CacheStatistics& previous) {
+	const ULONGLONG ullHits = current.ullHits - previous.ullHits, ullMisses = current.ullMisses - previous.ullMisses,
+		ullMissMicroseconds = current.ullMissMicroseconds - previous.ullMissMicroseconds;
+	printf("%-18s %10llu %10.1f %12.1f\n", lpszName, ullAccesses, ullHits * 100.0 / max(ullHits + ullMisses, 1ULL), (double)ullMissMicroseconds / max(ullMisses, 1ULL));
+	previous = current;
+}
+
+int main() {
+	const DWORD dwScanLineSize = (BENCHMARK_CANVAS_WIDTH * 3 + 3) & ~3;
+	const ULONGLONG ullCanvasSize = (ULONGLONG)dwScanLineSize * BENCHMARK_CANVAS_HEIGHT;
+	HANDLE hFile = CreateScratchFile(), hSection;
+	DWORD dwBytesReturned;
+	PBYTE pBits;
+	if (hFile == INVALID_HANDLE_VALUE ||
+		!DeviceIoControl(hFile, FSCTL_SET_SPARSE, NULL, 0, NULL, 0, &dwBytesReturned, NULL) ||
+		(hSection = CreateFileMappingW(hFile, NULL, PAGE_READWRITE, (DWORD)(ullCanvasSize >> 32), (DWORD)ullCanvasSize, NULL)) == NULL ||
+		(pBits = (PBYTE)MapViewOfFile(hSection, FILE_MAP_ALL_ACCESS, 0, 0, 0)) == NULL) {
+		printf("Failed to map the canvas: error %lu\n", GetLastError());
+		return 1;
+	}
+	LazyBitmap bitmap;
+	bitmap.Reset(pBits, dwScanLineSize, BENCHMARK_CANVAS_HEIGHT, BENCHMARK_MEMORY_BUDGET / 2);
+	const LONG lBandCount = (BENCHMARK_CANVAS_HEIGHT + LAZY_BITMAP_BAND_HEIGHT - 1) / LAZY_BITMAP_BAND_HEIGHT;
+	printf("%dx%d canvas (%llu MB), %d MB budget\n%-18s %10s %10s %12s\n", BENCHMARK_CANVAS_WIDTH, BENCHMARK_CANVAS_HEIGHT, ullCanvasSize >> 20, BENCHMARK_MEMORY_BUDGET >> 20, "workload", "accesses", "hit %", "miss us");
+	CacheStatistics previous = { 0 };
+	// Every band is written once, then again: the second pass misses on every band, since the canvas is several times the budget
+	for (int iPass = 0; iPass < 2; iPass++)
+		for (LONG i = 0; i < lBandCount; i++) {
+			bitmap.Write(i * LAZY_BITMAP_BAND_HEIGHT, (i + 1) * LAZY_BITMAP_BAND_HEIGHT);
+			pBits[(SIZE_T)i * LAZY_BITMAP_BAND_HEIGHT * dwScanLineSize] = (BYTE)i;
+		}
+	PrintStatistics("canvas sequential", lBandCount, bitmap.GetStatistics(), previous);
+	// Strokes wander a few bands at a time, like painting does
+	srand(1);
+	LONG lBand = lBandCount / 2;
+	for (int i = 0; i < BENCHMARK_BAND_WRITES; i++) {
+		lBand = min(max(lBand + rand() % 9 - 4, 0L), lBandCount - 1);
+		bitmap.Write(lBand * LAZY_BITMAP_BAND_HEIGHT, (lBand + 1) * LAZY_BITMAP_BAND_HEIGHT);
+	}
+	PrintStatistics("canvas local", BENCHMARK_BAND_WRITES, bitmap.GetStatistics(), previous);
+	for (int i = 0; i < BENCHMARK_BAND_WRITES; i++) {
+		lBand = (LONG)GetRandom(lBandCount);
+		bitmap.Write(lBand * LAZY_BITMAP_BAND_HEIGHT, (lBand + 1) * LAZY_BITMAP_BAND_HEIGHT);
+	}
+	PrintStatistics("canvas random", BENCHMARK_BAND_WRITES, bitmap.GetStatistics(), previous);
+	// History entries are mostly read back newest first by undo, and now and then anywhere by picks from the history panel
+	SpillCache cache;
+	cache.SetBudget(BENCHMARK_MEMORY_BUDGET / 2);
+	std::vector<ULONGLONG> ids;
+	for (int i = 0; i < BENCHMARK_PAYLOADS; i++)
+		ids.push_back(cache.Add(std::vector<BYTE>(BENCHMARK_PAYLOAD_SIZE, (BYTE)i)));
+	previous = cache.GetStatistics();
+	for (int i = 0; i < BENCHMARK_PAYLOAD_READS; i++)
+		if (!cache.Get(ids[BENCHMARK_PAYLOADS - 1 - i % (BENCHMARK_PAYLOADS / 8)])) {
+			printf("Failed to read a payload back: error %lu\n", GetLastError());
+			return 1;
+		}
+	PrintStatistics("history undo", BENCHMARK_PAYLOAD_READS, cache.GetStatistics(), previous);
+	for (int i = 0; i < BENCHMARK_PAYLOAD_READS; i++)
+		if (!cache.Get(ids[GetRandom(BENCHMARK_PAYLOADS)])) {
+			printf("Failed to read a payload back: error %lu\n", GetLastError());
+			return 1;
+		}
+	PrintStatistics("history random", BENCHMARK_PAYLOAD_READS, cache.GetStatistics(), previous);
+	UnmapViewOfFile(pBits);
+	CloseHandle(hSection);
+	CloseHandle(hFile);
+	return 0;
+}
\ No newline at end of file
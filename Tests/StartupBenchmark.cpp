@@ -0,0 +1,73 @@
+/*
+Starts a renderer the way the canvas window does at screen resolutions from 1366x768 to 7680x4320, both with the largest
+canvas mapping and with one of the screen size, and reports the time to the first paint of the visible canvas and how
+much the working set grew; both should stay flat as the resolution and the mapping grow.
+Build from a Developer Command Prompt: cl /nologo /O2 /EHsc /std:c++14 /I"..\Simple Paint" StartupBenchmark.cpp user32.lib gdi32.lib psapi.lib
+*/
+
+#include <Windows.h>
+#include <Psapi.h>
+#include <cstdio>
+#include "Renderer.h"
+
+#define BENCHMARK_MEMORY_BUDGET (512 << 20)
+
+#ifdef _WIN64
+#define BENCHMARK_CANVAS_MAX 24576
+#else
+#define BENCHMARK_CANVAS_MAX 8192
+#endif
+
+LONGLONG GetTime() {
+	LARGE_INTEGER counter;
+	QueryPerformanceCounter(&counter);
+	return counter.QuadPart;
+}
+
+SIZE_T GetWorkingSetSize() {
+	PROCESS_MEMORY_COUNTERS processMemoryCounters;
+	return GetProcessMemoryInfo(GetCurrentProcess(), &processMemoryCounters, sizeof(processMemoryCounters)) ? processMemoryCounters.WorkingSetSize : 0;
+}
+
+int main() {
+	const SIZE resolutions[] = { { 1366, 768 }, { 1920, 1080 }, { 2560, 1440 }, { 3840, 2160 }, { 7680, 4320 } };
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+	// The window is painted into a DIB section as large as the largest screen, touched once so it does not count as growth
+	const SIZE targetSize = resolutions[ARRAYSIZE(resolutions) - 1];
+	BITMAPINFO bitmapInfo = { sizeof(bitmapInfo.bmiHeader) };
+	bitmapInfo.bmiHeader.biWidth = targetSize.cx;
+	bitmapInfo.bmiHeader.biHeight = -targetSize.cy;
+	bitmapInfo.bmiHeader.biPlanes = 1;
+	bitmapInfo.bmiHeader.biBitCount = 24;
+	LPVOID pTargetBits;
+	HDC hDC_Target = CreateCompatibleDC(NULL);
+	HBITMAP hBitmap_Old = SelectBitmap(hDC_Target, CreateDIBSection(NULL, &bitmapInfo, DIB_RGB_COLORS, &pTargetBits, NULL, 0));
+	PatBlt(hDC_Target, 0, 0, targetSize.cx, targetSize.cy, BLACKNESS);
+	GdiFlush();
+	printf("%12s %12s %10s %14s %12s\n", "screen", "mapping", "start ms", "first paint ms", "growth KB");
+	for (const SIZE& size : resolutions)
+		for (int i = 0; i < 2; i++) {
+			// Same as the canvas window: the largest mapping first, the screen size if the scratch file has no room for it
+			const SIZE maxSize = i ? size : SIZE { BENCHMARK_CANVAS_MAX, BENCHMARK_CANVAS_MAX };
+			const SIZE_T uWorkingSetSize = GetWorkingSetSize();
+			const LONGLONG llStart = GetTime();
+			Renderer renderer;
+			if (!renderer.Start(NULL, maxSize, size, BENCHMARK_MEMORY_BUDGET)) {
+				printf("Failed to create a %ldx%ld canvas: error %lu\n", maxSize.cx, maxSize.cy, GetLastError());
+				return 1;
+			}
+			const LONGLONG llStarted = GetTime();
+			renderer.Flush();
+			const RECT rect = { 0, 0, size.cx, size.cy };
+			renderer.Copy(hDC_Target, 0, 0, rect);
+			GdiFlush();
+			const LONGLONG llPainted = GetTime();
+			const LONGLONG llGrowth = (LONGLONG)GetWorkingSetSize() - (LONGLONG)uWorkingSetSize;
+			printf("%5ldx%-6ld %5ldx%-6ld %10.1f %14.1f %12lld\n", size.cx, size.cy, maxSize.cx, maxSize.cy, (llStarted - llStart) * 1e3 / frequency.QuadPart, (llPainted - llStart) * 1e3 / frequency.QuadPart, llGrowth / 1024);
+			renderer.Stop();
+		}
+	DeleteBitmap(SelectBitmap(hDC_Target, hBitmap_Old));
+	DeleteDC(hDC_Target);
+	return 0;
+}
\ No newline at end of file
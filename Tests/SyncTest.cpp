@@ -0,0 +1,273 @@
+/*
+Runs a coordinator on a private pipe in this process and joins several replicas to it, each with a renderer of its own.
+The replicas take turns drawing random strokes, fills and shapes and issuing resizes, clears and history jumps while
+batches from the others arrive, and all of them must end with the same canvas and history. Reports ops per second and
+the mean time from sending a batch to receiving its echo. Then cuts a real log at every byte, which must read back
+without running past its end, and sends a cut batch from a raw pipe client, which the coordinator must drop unordered.
+Build from a Developer Command Prompt: cl /nologo /O2 /EHsc /std:c++14 /I"..\Simple Paint" SyncTest.cpp user32.lib gdi32.lib
+*/
+
+#include <Windows.h>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include "Sync.h"
+
+#define TEST_REPLICAS 4
+#define TEST_OPERATIONS 2000
+#define TEST_MEMORY_BUDGET (64 << 20)
+#define TEST_SETTLE_TIMEOUT 10000 // milliseconds for every ordered batch to reach every replica
+
+struct TestReplica {
+	Renderer renderer;
+	SyncReplica replica;
+	size_t uHistoryPosition, uHistoryCount, uHistoryVersion; // the mirror MainWindow keeps
+	ULONGLONG ullOrdered; // history changes and jumps applied in the shared order, dropped jumps included
+	ULONGLONG ullDroppedJumps;
+};
+
+TestReplica replicas[TEST_REPLICAS];
+
+// Same as ApplyCommand in MainWindow.cpp
+template <int i>
+void ApplyCommand(const RenderCommand& command) {
+	TestReplica& replica = replicas[i];
+	switch (command.Type) {
+	case RenderCommandTypes::Commit: case RenderCommandTypes::DrawShape: case RenderCommandTypes::Resize: case RenderCommandTypes::Jump: case RenderCommandTypes::Clear: replica.ullOrdered++; break;
+	}
+	if (command.Type == RenderCommandTypes::Jump && command.uBaseVersion != replica.uHistoryVersion) {
+		replica.ullDroppedJumps++;
+		return;
+	}
+	replica.renderer.Submit(command);
+	switch (command.Type) {
+	case RenderCommandTypes::Commit: case RenderCommandTypes::DrawShape: case RenderCommandTypes::Resize: {
+		replica.uHistoryCount = ++replica.uHistoryPosition;
+		replica.uHistoryVersion++;
+	}	break;
+	case RenderCommandTypes::Jump: {
+		replica.uHistoryPosition = command.uTarget;
+		replica.uHistoryVersion++;
+	}	break;
+	case RenderCommandTypes::Clear: replica.uHistoryPosition = replica.uHistoryCount = replica.uHistoryVersion = 0; break;
+	}
+}
+
+const CommandProc applyProcs[] = { ApplyCommand<0>, ApplyCommand<1>, ApplyCommand<2>, ApplyCommand<3> };
+static_assert(_countof(applyProcs) == TEST_REPLICAS, "one ApplyCommand per replica");
+
+DWORD WINAPI CoordinatorProc(LPVOID lpParameter) { return (DWORD)((SyncCoordinator*)lpParameter)->Run(); }
+
+// Lets every replica but uExcept apply what it has received, as their window procedures would between inputs
+void Pump(size_t uExcept) {
+	for (size_t i = 0; i < TEST_REPLICAS; i++)
+		if (i != uExcept && rand() % 2)
+			replicas[i].replica.Receive();
+}
+
+// Rows whose pixels differ between the canvases of two flushed renderers, reading unwritten bands as white
+LONG CompareCanvases(const Renderer& renderer1, const Renderer& renderer2) {
+	const SIZE size = renderer1.GetBitmapSize(), size2 = renderer2.GetBitmapSize();
+	if (size.cx != size2.cx || size.cy != size2.cy)
+		return max(size.cy, size2.cy);
+	const LazyBitmap& bitmap1 = renderer1.GetBitmap(), & bitmap2 = renderer2.GetBitmap();
+	const std::vector<BYTE> white((SIZE_T)size.cx * 3, 0xff);
+	LONG lDifferentRows = 0;
+	for (LONG y = 0; y < size.cy; y++) {
+		LPCBYTE pRow1 = bitmap1.IsMaterialized(y) ? bitmap1.GetBits() + y * bitmap1.GetScanLineSize() : white.data(),
+			pRow2 = bitmap2.IsMaterialized(y) ? bitmap2.GetBits() + y * bitmap2.GetScanLineSize() : white.data();
+		lDifferentRows += memcmp(pRow1, pRow2, white.size()) != 0;
+	}
+	return lDifferentRows;
+}
+
+// Coordinates on half pixels and pressures in 1/1024 steps, which the op log stores exactly
+float RandomCoordinate(LONG lExtent) { return (rand() % (2 * lExtent)) / 2.0f; }
+
+float RandomPressure() { return (1 + rand() % 1024) / 1024.0f; }
+
+int main() {
+	const SIZE maxSize = { 640, 480 }, size = { 512, 384 };
+	const std::wstring pipeName = L"\\\\.\\pipe\\SimplePaint.SyncTest." + std::to_wstring(GetCurrentProcessId());
+	SyncCoordinator coordinator(pipeName.c_str());
+	HANDLE hCoordinator = CreateThread(NULL, 0, CoordinatorProc, &coordinator, 0, NULL);
+	srand(1);
+	// The first replica's log seeds the session, so the others apply its initial Clear too
+	replicas[0].ullOrdered = 1;
+	for (size_t i = 0; i < TEST_REPLICAS; i++) {
+		TestReplica& replica = replicas[i];
+		if (!replica.renderer.Start(NULL, maxSize, size, TEST_MEMORY_BUDGET) ||
+			!replica.replica.Join(NULL, replica.renderer, replica.renderer.GetOpLog(), applyProcs[i], pipeName.c_str())) {
+			printf("Replica %zu failed to join: error %lu\n", i, GetLastError());
+			return 1;
+		}
+		// Wait for the coordinator to take the join, so that replicas join in order
+		RenderCommand command = { RenderCommandTypes::DrawShape, 0, L"Shape" };
+		command.DrawnShape = { (ShapeTypes)(i % 3), { rand() % size.cx, rand() % size.cy }, { rand() % size.cx, rand() % size.cy }, RGB(rand() & 0xff, rand() & 0xff, rand() & 0xff), 1 + rand() % 8, FALSE };
+		replica.replica.Issue(command);
+		replica.replica.WaitForEchoes();
+	}
+	ULONGLONG ullOrdered = 1 + TEST_REPLICAS, ullIssued = 0, ullJumps = 0;
+	LARGE_INTEGER frequency, startTime, endTime;
+	QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&startTime);
+	for (int i = 0; i < TEST_OPERATIONS; i++) {
+		const size_t uReplica = rand() % TEST_REPLICAS;
+		TestReplica& replica = replicas[uReplica];
+		const int iAction = rand() % 100;
+		RenderCommand command = { RenderCommandTypes::BeginStroke };
+		if (iAction < 55) {
+			command.Color = RGB(rand() & 0xff, rand() & 0xff, rand() & 0xff);
+			command.bHardness = (BYTE)(rand() & 0xff);
+			command.fX = RandomCoordinate(size.cx);
+			command.fY = RandomCoordinate(size.cy);
+			command.fPressure = RandomPressure();
+			command.fDiameter = (float)(1 + rand() % 32);
+			command.fSpacing = 0.1f;
+			replica.replica.Issue(command);
+			command.Type = RenderCommandTypes::StrokeTo;
+			for (int j = rand() % 20; j; j--, ullIssued++) {
+				command.fX = RandomCoordinate(size.cx);
+				command.fY = RandomCoordinate(size.cy);
+				command.fPressure = RandomPressure();
+				replica.replica.Issue(command);
+				Pump(uReplica);
+			}
+		}
+		else if (iAction < 60) {
+			command.Type = RenderCommandTypes::Fill;
+			command.Color = RGB(rand() & 0xff, rand() & 0xff, rand() & 0xff);
+			command.fX = (float)(rand() % size.cx);
+			command.fY = (float)(rand() % size.cy);
+			replica.replica.Issue(command);
+		}
+		else if (iAction < 75) {
+			command.Type = RenderCommandTypes::DrawShape;
+			command.lpcwName = L"Shape";
+			command.DrawnShape = { (ShapeTypes)(rand() % 3), { rand() % size.cx, rand() % size.cy }, { rand() % size.cx, rand() % size.cy }, RGB(rand() & 0xff, rand() & 0xff, rand() & 0xff), 1 + rand() % 8, rand() % 2 };
+			replica.replica.Issue(command);
+			ullOrdered++;
+		}
+		else if (iAction < 92) {
+			// Undo, redo or a pick from the history list, chosen on the history as this replica has it
+			replica.replica.WaitForEchoes();
+			if (!replica.uHistoryCount)
+				continue;
+			command.Type = RenderCommandTypes::Jump;
+			command.uTarget = rand() % replica.uHistoryCount;
+			if (command.uTarget >= replica.uHistoryPosition)
+				command.uTarget++;
+			command.uBaseVersion = replica.uHistoryVersion;
+			replica.replica.Issue(command);
+			ullJumps++;
+			ullOrdered++;
+		}
+		else if (iAction < 99) {
+			command.Type = RenderCommandTypes::Resize;
+			command.Size = { 64 + rand() % (maxSize.cx - 63), 64 + rand() % (maxSize.cy - 63) };
+			replica.replica.Issue(command);
+			ullOrdered++;
+		}
+		else {
+			command.Type = RenderCommandTypes::Clear;
+			command.Size = size;
+			replica.replica.Issue(command);
+			ullOrdered++;
+		}
+		if (iAction < 60) {
+			Pump(uReplica);
+			// Strokes and fills are pending until committed, and some are cancelled instead
+			const BOOL bCancel = rand() % 10 == 0;
+			const RenderCommand end = { bCancel ? RenderCommandTypes::Cancel : RenderCommandTypes::Commit, 0, L"Pen" };
+			replica.replica.Issue(end);
+			ullIssued++;
+			if (!bCancel)
+				ullOrdered++;
+		}
+		ullIssued++;
+		Pump(TEST_REPLICAS);
+	}
+	// Every replica must apply every ordered batch
+	BOOL bSettled = FALSE;
+	for (const ULONGLONG ullDeadline = GetTickCount64() + TEST_SETTLE_TIMEOUT; !bSettled && GetTickCount64() < ullDeadline;) {
+		bSettled = TRUE;
+		for (size_t i = 0; i < TEST_REPLICAS; i++) {
+			replicas[i].replica.Receive();
+			bSettled &= replicas[i].ullOrdered == ullOrdered;
+		}
+		if (!bSettled)
+			Sleep(SYNC_RETRY_INTERVAL);
+	}
+	QueryPerformanceCounter(&endTime);
+	// Only cuts between commands are well-formed: a command cut short always needs bytes past the end
+	replicas[0].renderer.Flush();
+	const OpLog opLog = replicas[0].renderer.GetOpLog();
+	const std::vector<BYTE>& bytes = opLog.GetBytes();
+	size_t uCommandCount = 0, uWellFormedCuts = 0;
+	RenderCommand command;
+	for (OpLog::Reader reader(opLog); reader.Read(command); uCommandCount++);
+	for (size_t uSize = 0; uSize <= bytes.size(); uSize++)
+		uWellFormedCuts += OpLog(std::vector<BYTE>(bytes.begin(), bytes.begin() + uSize)).IsWellFormed();
+	const BOOL bCutsRejected = uWellFormedCuts == uCommandCount + 1;
+	// A client that joins and then sends a cut batch is disconnected, and nobody else sees the batch
+	BOOL bClientDropped = FALSE;
+	HANDLE hPipe = CreateFileW(pipeName.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, FILE_FLAG_OVERLAPPED, NULL);
+	if (hPipe != INVALID_HANDLE_VALUE) {
+		HANDLE hEvent = CreateEventW(NULL, TRUE, FALSE, NULL);
+		DWORD dwMode = PIPE_READMODE_MESSAGE;
+		std::vector<BYTE> message;
+		if (SetNamedPipeHandleState(hPipe, &dwMode, NULL, NULL) &&
+			WritePipeMessage(hPipe, hEvent, SyncMessageTypes::Join, OpLog().GetBytes()) &&
+			WritePipeMessage(hPipe, hEvent, SyncMessageTypes::Batch, std::vector<BYTE>(bytes.begin(), bytes.end() - 1)))
+			for (const ULONGLONG ullDeadline = GetTickCount64() + SYNC_CONNECT_TIMEOUT; !bClientDropped && GetTickCount64() < ullDeadline;) {
+				// The session sent on joining is read off as it comes, so that only the disconnection ends the loop
+				DWORD dwBytesAvailable;
+				if (!PeekNamedPipe(hPipe, NULL, 0, NULL, &dwBytesAvailable, NULL))
+					bClientDropped = TRUE;
+				else if (dwBytesAvailable)
+					ReadPipeMessage(hPipe, hEvent, message);
+				else
+					Sleep(SYNC_RETRY_INTERVAL);
+			}
+		CloseHandle(hEvent);
+		CloseHandle(hPipe);
+	}
+	Sleep(SYNC_RETRY_INTERVAL);
+	for (size_t i = 0; i < TEST_REPLICAS; i++) {
+		replicas[i].replica.Receive();
+		bSettled &= replicas[i].ullOrdered == ullOrdered;
+	}
+	LONG lDifferentRows = 0;
+	BOOL bHistoriesMatch = TRUE;
+	float fOpsPerSecond;
+	ULONGLONG ullRoundTripMicroseconds, ullRoundTripSum = 0;
+	for (size_t i = 0; i < TEST_REPLICAS; i++) {
+		const TestReplica& replica = replicas[i], & first = replicas[0];
+		replicas[i].renderer.Flush();
+		lDifferentRows += CompareCanvases(first.renderer, replica.renderer);
+		bHistoriesMatch &= replica.uHistoryPosition == first.uHistoryPosition && replica.uHistoryCount == first.uHistoryCount &&
+			replica.uHistoryVersion == first.uHistoryVersion && replica.ullDroppedJumps == first.ullDroppedJumps;
+		while (!replicas[i].replica.GetStatistics(fOpsPerSecond, ullRoundTripMicroseconds))
+			Sleep(SYNC_RETRY_INTERVAL);
+		ullRoundTripSum += ullRoundTripMicroseconds;
+	}
+	printf("%d replicas, %llu ops issued, %llu batches ordered, %llu of %llu jumps dropped as stale, %ld rows differ, histories %s\n"
+		"%.0f ops/s issued, %llu us mean round trip\n", TEST_REPLICAS, ullIssued, ullOrdered, replicas[0].ullDroppedJumps, ullJumps,
+		lDifferentRows, bHistoriesMatch ? "match" : "differ", ullIssued * (double)frequency.QuadPart / (endTime.QuadPart - startTime.QuadPart),
+		ullRoundTripSum / TEST_REPLICAS);
+	printf("%zu of %zu cuts of a %zu-byte log well-formed, cut batch %s\n", uWellFormedCuts, bytes.size() + 1, bytes.size(),
+		bClientDropped ? "dropped" : "not dropped");
+	for (auto& replica : replicas) {
+		replica.replica.Leave();
+		replica.renderer.Stop();
+	}
+	// The coordinator returns once its last replica has left
+	const BOOL bCoordinatorDone = WaitForSingleObject(hCoordinator, SYNC_CONNECT_TIMEOUT) == WAIT_OBJECT_0;
+	if (!bCoordinatorDone)
+		printf("The coordinator did not stop after the last replica left\n");
+	CloseHandle(hCoordinator);
+	const BOOL bPassed = bSettled && !lDifferentRows && bHistoriesMatch && bCoordinatorDone && bCutsRejected && bClientDropped;
+	printf(bPassed ? "PASSED\n" : "FAILED\n");
+	return bPassed ? 0 : 1;
+}
\ No newline at end of file
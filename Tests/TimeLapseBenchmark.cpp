@@ -0,0 +1,82 @@
+/*
+Exports the same recorded drawing, scaled up to canvases from 1920x1080 to the largest canvas size, as an uncompressed
+AVI time-lapse and reports the frame size, the frame buffer size and the export frame rate; frames stay at most 1920x1080,
+so the frame buffer should not grow with the canvas.
+Build from a Developer Command Prompt: cl /nologo /O2 /EHsc /std:c++14 /I"..\Simple Paint" TimeLapseBenchmark.cpp user32.lib gdi32.lib
+*/
+
+#include <Windows.h>
+#include <cstdio>
+#include <cstdlib>
+#include "TimeLapse.h"
+
+#define BENCHMARK_MEMORY_BUDGET (512 << 20)
+#define BENCHMARK_STROKES 128
+#define BENCHMARK_SEGMENTS 8
+#define BENCHMARK_SEGMENT_TIME 20 // milliseconds, so the drawing takes about 20 seconds
+#define BENCHMARK_FRAME_RATE 30
+#define BENCHMARK_SPEED 10
+
+#ifdef _WIN64
+#define BENCHMARK_CANVAS_MAX 24576
+#else
+#define BENCHMARK_CANVAS_MAX 8192
+#endif
+
+int main() {
+	const SIZE sizes[] = { { 1920, 1080 }, { 3840, 2160 }, { 8192, 8192 }, { 24576, 24576 } };
+	WCHAR szTempPath[MAX_PATH], szFileName[MAX_PATH];
+	if (!GetTempPathW(ARRAYSIZE(szTempPath), szTempPath) || !GetTempFileNameW(szTempPath, L"tl", 0, szFileName)) {
+		printf("Failed to create a temporary file: error %lu\n", GetLastError());
+		return 1;
+	}
+	printf("%12s %12s %10s %8s %10s\n", "canvas", "frame", "buffer KB", "frames", "frames/s");
+	for (const SIZE& size : sizes) {
+		if (size.cx > BENCHMARK_CANVAS_MAX || size.cy > BENCHMARK_CANVAS_MAX)
+			break;
+		// Strokes are placed at the same relative positions and scaled with the canvas, so every size records the same drawing
+		const float fScale = (float)min(size.cx, size.cy) / 1080;
+		OpLog opLog;
+		RenderCommand command = { RenderCommandTypes::Clear };
+		command.Size = size;
+		opLog.Record(command, 0);
+		ULONGLONG ullTime = 0;
+		srand(1);
+		for (int i = 0; i < BENCHMARK_STROKES; i++) {
+			command = { RenderCommandTypes::BeginStroke };
+			command.Color = RGB(rand() & 0xff, rand() & 0xff, rand() & 0xff);
+			command.bHardness = 0x80;
+			command.fX = (float)(rand() % size.cx);
+			command.fY = (float)(rand() % size.cy);
+			command.fPressure = 1;
+			command.fDiameter = 16 * fScale;
+			command.fSpacing = 0.1f;
+			opLog.Record(command, ullTime);
+			command.Type = RenderCommandTypes::StrokeTo;
+			for (int j = 0; j < BENCHMARK_SEGMENTS; j++) {
+				command.fX = min(max(command.fX + (rand() % 65 - 32) * fScale, 0.0f), (float)size.cx - 1);
+				command.fY = min(max(command.fY + (rand() % 65 - 32) * fScale, 0.0f), (float)size.cy - 1);
+				opLog.Record(command, ullTime += BENCHMARK_SEGMENT_TIME);
+			}
+			const RenderCommand commit = { RenderCommandTypes::Commit, 0, L"Pen" };
+			opLog.Record(commit, ullTime);
+		}
+		TimeLapseExporter exporter;
+		if (!exporter.Start(NULL, opLog, size, size, BENCHMARK_MEMORY_BUDGET, { BENCHMARK_FRAME_RATE, BENCHMARK_SPEED }, szFileName, TimeLapseFormats::AVI)) {
+			printf("Failed to start the export: error %lu\n", GetLastError());
+			return 1;
+		}
+		size_t uFrameCount;
+		float fFramesPerSecond;
+		const DWORD dwError = exporter.Finish(uFrameCount, fFramesPerSecond);
+		if (dwError != ERROR_SUCCESS) {
+			printf("Failed to export a %ldx%ld canvas: error %lu\n", size.cx, size.cy, dwError);
+			DeleteFileW(szFileName);
+			return 1;
+		}
+		const SIZE frameSize = exporter.GetFrameSize();
+		printf("%5ldx%-6ld %5ldx%-6ld %10lu %8u %10.1f\n", size.cx, size.cy, frameSize.cx, frameSize.cy, (((3 * frameSize.cx + 3) & ~3UL) * frameSize.cy) >> 10, (UINT)uFrameCount, fFramesPerSecond);
+	}
+	DeleteFileW(szFileName);
+	return 0;
+}
\ No newline at end of file